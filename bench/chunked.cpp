@@ -0,0 +1,100 @@
+/*
+ * Throughput of large transfers: a run of single frames against one chunked message of the
+ * same total size, at a few chunk sizes. Each transfer is encoded and decoded a block at a
+ * time the way a module would, using the bulk body paths on both sides.
+ *
+ * Usage: tipsy-encoder-bench-chunked [total MB]
+ */
+
+#include "tipsy/tipsy.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+static constexpr size_t kBlock{512};
+
+template <typename Encoder, typename Decoder>
+bool transfer(Encoder &enc, Decoder &dec, std::vector<float> &buf)
+{
+    bool done{false};
+    while (!enc.isDormant())
+    {
+        auto n = enc.getNextMessageFloats(buf.data(), buf.size());
+        size_t i{0};
+        while (i < n)
+        {
+            i += dec.readBodyFloats(buf.data() + i, n - i);
+            if (i == n)
+                break;
+            auto r = dec.readFloat(buf[i++]);
+            if (Decoder::isError(r))
+                return false;
+            done = done || r == tipsy::DecoderResult::BODY_READY;
+        }
+    }
+    return done;
+}
+
+double seconds(std::chrono::steady_clock::time_point from)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - from).count();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint64_t totalMB = argc > 1 ? strtoul(argv[1], nullptr, 10) : 64;
+    uint64_t total = totalMB << 20;
+    std::vector<unsigned char> src(total), dst(total + 1);
+    for (uint64_t i = 0; i < total; ++i)
+        src[i] = (unsigned char)(i * 2654435761u >> 13);
+    std::vector<float> buf(kBlock);
+
+    printf("%llu MB, %zu float blocks, %s kernels\n", (unsigned long long)totalMB, kBlock,
+           tipsy::simdLevelName(tipsy::activeKernels().level));
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        {
+            auto start = std::chrono::steady_clock::now();
+            bool ok{true};
+            for (uint64_t off = 0; off < total && ok; off += tipsy::kMaxMessageLength)
+            {
+                auto n = total - off < tipsy::kMaxMessageLength ? total - off
+                                                                : tipsy::kMaxMessageLength;
+                tipsy::ProtocolEncoder pe;
+                pe.setEncodingVersion(version);
+                tipsy::ProtocolDecoder pd;
+                pd.provideDataBuffer(dst.data() + off, (uint32_t)n + 1);
+                ok = pe.initiateMessage("application/octet-stream", (uint32_t)n,
+                                        src.data() + off) ==
+                         tipsy::EncoderResult::MESSAGE_INITIATED &&
+                     transfer(pe, pd, buf);
+            }
+            auto t = seconds(start);
+            printf("v%d single 8 MB frames      %8.1f MB/s %s\n", version, totalMB / t,
+                   ok ? "" : "FAILED");
+        }
+
+        for (uint32_t chunk : {64u << 10, 1u << 20, (uint32_t)tipsy::kMaxMessageLength})
+        {
+            auto start = std::chrono::steady_clock::now();
+            tipsy::ChunkedProtocolEncoder ce;
+            ce.setEncodingVersion(version);
+            ce.setChunkSize(chunk);
+            tipsy::ChunkedProtocolDecoder cd;
+            cd.provideDataBuffer(dst.data(), (uint32_t)dst.size());
+            bool ok = ce.initiateMessage("application/octet-stream", total, src.data()) ==
+                          tipsy::EncoderResult::MESSAGE_INITIATED &&
+                      transfer(ce, cd, buf);
+            auto t = seconds(start);
+            printf("v%d chunked %5u KB frames   %8.1f MB/s %s\n", version, chunk >> 10,
+                   totalMB / t, ok ? "" : "FAILED");
+        }
+    }
+    return 0;
+}
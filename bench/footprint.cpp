@@ -0,0 +1,253 @@
+/*
+ * Decoder footprint: 10k decoders, one per poly channel per module, each fed one float a
+ * sample the way a host does, first on idle cables and then all in the middle of a body.
+ * Reports the size of a decoder, the memory they take between them and the time per float,
+ * for the decoder as it is and for BaselineDecoder, the decoder as it was before its hot
+ * state was gathered into one cache line. Both are fed the same stream.
+ *
+ * The layout question is how many cache lines each sample pulls in, which timing alone
+ * only hints at. Counting them takes hardware counters, so run each layout on its own
+ *     perf stat -e cache-references,cache-misses tipsy-encoder-bench-footprint current
+ *     perf stat -e cache-references,cache-misses tipsy-encoder-bench-footprint baseline
+ * and compare the two.
+ *
+ * Usage: tipsy-encoder-bench-footprint [current|baseline|both] [decoders] [samples]
+ */
+
+#include "tipsy/tipsy.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+static const char *kMimeType{"application/octet-stream"};
+
+/*
+ * The baseline decoder's members in their original order, and its readFloat trimmed to
+ * what a version 1 stream exercises. The state sits at the front but the body pointer and
+ * size come after the mime type, so a body float touches two cache lines.
+ */
+struct BaselineDecoder
+{
+    using DecoderResult = tipsy::DecoderResult;
+
+    bool provideDataBuffer(unsigned char *data, uint32_t size)
+    {
+        if (decoderState == DecoderState::START_BODY)
+            return false;
+
+        dataStore = data;
+        dataStoreSize = size;
+        return true;
+    }
+
+    DecoderResult readFloat(float f)
+    {
+        if (f == tipsy::kMessageBeginSentinel)
+        {
+            setState(DecoderState::START_HEADER);
+            dataSize = 0;
+            memset(mimetype, 0, sizeof(mimetype));
+            version = 0;
+            return DecoderResult::PARSING_HEADER;
+        }
+        if (f == tipsy::kVersionSentinel)
+        {
+            setState(DecoderState::START_VERSION);
+            return DecoderResult::PARSING_HEADER;
+        }
+        if (f == tipsy::kSizeSentinel)
+        {
+            setState(DecoderState::START_SIZE);
+            return DecoderResult::PARSING_HEADER;
+        }
+        if (f == tipsy::kMimeTypeSentinel)
+        {
+            setState(DecoderState::START_MIMETYPE);
+            return DecoderResult::PARSING_HEADER;
+        }
+        if (f == tipsy::kBodySentinel)
+        {
+            setState(DecoderState::START_BODY);
+            return DecoderResult::HEADER_READY;
+        }
+        if (f == tipsy::kEndMessageSentinel)
+        {
+            setState(DecoderState::DOING_NOTHING);
+            return DecoderResult::BODY_READY;
+        }
+
+        switch (decoderState)
+        {
+        case DecoderState::DOING_NOTHING:
+            return DecoderResult::DORMANT;
+        case DecoderState::START_HEADER:
+            return DecoderResult::PARSING_HEADER;
+        case DecoderState::START_VERSION:
+            if (pos != 0)
+                return DecoderResult::ERROR_MALFORMED_HEADER;
+            version = tipsy::uint16_FromFloat(f);
+            pos++;
+            if (version != tipsy::kVersion24Bit)
+                return DecoderResult::ERROR_INCOMPATIBLE_VERSION;
+            return DecoderResult::PARSING_HEADER;
+        case DecoderState::START_SIZE:
+            if (pos != 0)
+                return DecoderResult::ERROR_MALFORMED_HEADER;
+            dataSize = tipsy::uint32_FromFloat(f);
+            if (dataSize >= dataStoreSize)
+                return DecoderResult::ERROR_DATA_TOO_LARGE;
+            pos++;
+            return DecoderResult::PARSING_HEADER;
+        case DecoderState::START_MIMETYPE:
+        {
+            if (pos == 0)
+            {
+                mimetypeSize = tipsy::uint16_FromFloat(f);
+                pos++;
+                return DecoderResult::PARSING_HEADER;
+            }
+            if (pos > mimetypeSize)
+                return DecoderResult::ERROR_MALFORMED_HEADER;
+            if (pos >= tipsy::kMaxMimeTypeSize - 4)
+                return DecoderResult::ERROR_DATA_TOO_LARGE;
+            auto wp = pos - 1;
+            auto fb = tipsy::FloatBytes(f);
+            mimetype[wp] = fb.first();
+            mimetype[wp + 1] = fb.second();
+            mimetype[wp + 2] = fb.third();
+            pos += 3;
+            return DecoderResult::PARSING_HEADER;
+        }
+        case DecoderState::START_BODY:
+        {
+            if (pos >= dataSize || pos >= dataStoreSize)
+                return DecoderResult::ERROR_DATA_TOO_LARGE;
+            auto fb = tipsy::FloatBytes(f);
+            unsigned char b[3]{fb.first(), fb.second(), fb.third()};
+            for (int i = 0; i < 3 && pos < dataSize && pos < dataStoreSize; ++i)
+                dataStore[pos++] = b[i];
+            return DecoderResult::PARSING_BODY;
+        }
+        }
+        return DecoderResult::ERROR_UNKNOWN;
+    }
+
+    static bool isError(DecoderResult r) { return tipsy::ProtocolDecoder::isError(r); }
+
+  private:
+    enum class DecoderState : uint8_t
+    {
+        DOING_NOTHING,
+        START_VERSION,
+        START_HEADER,
+        START_SIZE,
+        START_MIMETYPE,
+        START_BODY
+    } decoderState{DecoderState::DOING_NOTHING};
+
+    uint32_t pos{0};
+    uint16_t version{0};
+    uint32_t dataSize{0};
+    char mimetype[tipsy::kMaxMimeTypeSize]{};
+    uint16_t mimetypeSize{0};
+
+    unsigned char *dataStore{nullptr};
+    uint32_t dataStoreSize{0};
+
+    void setState(DecoderState s)
+    {
+        decoderState = s;
+        pos = 0;
+    }
+};
+
+// Seconds per decoder per sample feeding f[0..samples) to every decoder in turn
+template <typename D>
+double feed(std::vector<D> &decoders, const float *f, size_t samples, bool &ok)
+{
+    auto start = std::chrono::steady_clock::now();
+    for (size_t s = 0; s < samples; ++s)
+    {
+        for (auto &d : decoders)
+        {
+            auto r = d.readFloat(f[s]);
+            ok = ok && !D::isError(r);
+        }
+    }
+    auto t = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return t / (decoders.size() * samples);
+}
+
+template <typename D>
+void run(const char *name, size_t n, size_t samples, const std::vector<float> &message,
+         size_t bodyStart, std::vector<unsigned char> &buffer)
+{
+    std::vector<D> decoders(n);
+    for (auto &d : decoders)
+        d.provideDataBuffer(buffer.data(), (uint32_t)buffer.size());
+
+    bool ok{true};
+    std::vector<float> idle(samples, 0.f);
+    auto idleT = feed(decoders, idle.data(), samples, ok);
+
+    // bring every decoder up to the body, then time the body
+    feed(decoders, message.data(), bodyStart, ok);
+    auto bodyT = feed(decoders, message.data() + bodyStart, samples, ok);
+
+    printf("%-9s %10zu %10.2f %15.2f %15.2f %s\n", name, sizeof(D),
+           n * sizeof(D) / 1048576.0, idleT * 1e9, bodyT * 1e9, ok ? "" : "FAILED");
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    const char *layout = argc > 1 ? argv[1] : "both";
+    bool current = !strcmp(layout, "current") || !strcmp(layout, "both");
+    bool baseline = !strcmp(layout, "baseline") || !strcmp(layout, "both");
+    if (!current && !baseline)
+    {
+        printf("Usage: %s [current|baseline|both] [decoders] [samples]\n", argv[0]);
+        return 1;
+    }
+    size_t n = argc > 2 ? strtoul(argv[2], nullptr, 10) : 10000;
+    size_t samples = argc > 3 ? strtoul(argv[3], nullptr, 10) : 2000;
+
+    // one version 1 message long enough that every timed sample is a body float
+    std::vector<unsigned char> payload(3 * samples + 3);
+    for (size_t i = 0; i < payload.size(); ++i)
+        payload[i] = (unsigned char)(i * 31 + 7);
+    tipsy::ProtocolEncoder pe;
+    if (!pe.setEncodingVersion(tipsy::kVersion24Bit) ||
+        pe.initiateMessage(kMimeType, (uint32_t)payload.size(), payload.data()) !=
+            tipsy::EncoderResult::MESSAGE_INITIATED)
+    {
+        printf("Could not encode a %zu byte message\n", payload.size());
+        return 1;
+    }
+    std::vector<float> message;
+    size_t bodyStart{0};
+    float f;
+    while (!pe.isDormant())
+    {
+        (void)pe.getNextMessageFloat(f);
+        message.push_back(f);
+        if (f == tipsy::kBodySentinel)
+            bodyStart = message.size();
+    }
+
+    // the decoders all share one buffer so the body writes stay in cache
+    std::vector<unsigned char> buffer(payload.size() + 1);
+
+    printf("%zu decoders, %zu samples\n", n, samples);
+    printf("layout    bytes each   total MB   idle ns/float   body ns/float\n");
+    if (current)
+        run<tipsy::ProtocolDecoder>("current", n, samples, message, bodyStart, buffer);
+    if (baseline)
+        run<BaselineDecoder>("baseline", n, samples, message, bodyStart, buffer);
+    return 0;
+}
@@ -0,0 +1,197 @@
+/*
+ * Corruption recovery: a long run of messages with damage injected every few messages,
+ * decoded in blocks three ways. "none" is the plain decoder, "on error" resyncs after any
+ * error and "explicit" has the host call resync at each injection, as it would when it sees
+ * a cable repatched. For each kind of damage this reports the errors raised, the messages
+ * delivered intact, those delivered complete but wrong, the floats thrown away per resync
+ * and the decode rate.
+ *
+ * Usage: tipsy-encoder-bench-resync [messages]
+ */
+
+#include "tipsy/tipsy.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <vector>
+
+namespace
+{
+static constexpr size_t kBlock{64};
+static constexpr uint32_t kMessageBytes{200};
+static constexpr int kDamageEvery{5};
+
+enum Damage
+{
+    DROP_FLOAT,
+    NOISE_BURST,
+    REPATCH,
+    N_DAMAGE
+};
+const char *damageName[N_DAMAGE]{"drop float", "noise burst", "repatch"};
+
+enum Mode
+{
+    NONE,
+    ON_ERROR,
+    EXPLICIT,
+    N_MODES
+};
+const char *modeName[N_MODES]{"none", "on error", "explicit"};
+
+void payloadFor(uint32_t m, unsigned char *p)
+{
+    memcpy(p, &m, sizeof(m));
+    for (uint32_t j = sizeof(m); j < kMessageBytes; ++j)
+        p[j] = (unsigned char)(m * 13 + j);
+}
+
+std::vector<float> encode(uint32_t m)
+{
+    unsigned char p[kMessageBytes];
+    payloadFor(m, p);
+    tipsy::ProtocolEncoder pe;
+    (void)pe.initiateMessage("application/octet-stream", kMessageBytes, p);
+    std::vector<float> res;
+    float f;
+    while (!pe.isDormant())
+    {
+        (void)pe.getNextMessageFloat(f);
+        res.push_back(f);
+    }
+    return res;
+}
+
+// The message stream with damage every kDamageEvery messages, noting where it went in
+std::vector<float> damagedStream(uint32_t count, Damage d, std::vector<size_t> &injections)
+{
+    std::vector<float> s;
+    uint32_t seed{17};
+    auto rnd = [&seed]() { return seed = seed * 1664525 + 1013904223; };
+    for (uint32_t m = 0; m < count; ++m)
+    {
+        auto e = encode(m);
+        if (m % kDamageEvery == kDamageEvery - 1)
+        {
+            // somewhere in the body, which is where almost all of a message's floats are
+            auto at = e.size() / 4 + rnd() % (e.size() / 2);
+            injections.push_back(s.size() + at);
+            if (d == DROP_FLOAT)
+            {
+                e.erase(e.begin() + at);
+            }
+            else if (d == NOISE_BURST)
+            {
+                for (size_t i = at; i < at + 8; ++i)
+                    e[i] = (float)(rnd() % 20000) * 0.001f - 10.f;
+            }
+            else
+            {
+                // the rest of this message is replaced by the tail end of a longer one
+                auto other = encode(m + count);
+                other.insert(other.begin() + other.size() / 2, other.size(), 0.2f);
+                e.resize(at);
+                e.insert(e.end(), other.begin() + other.size() / 8, other.end());
+            }
+        }
+        s.insert(s.end(), e.begin(), e.end());
+        s.insert(s.end(), 32, 0.f);
+    }
+    return s;
+}
+
+struct Result
+{
+    uint64_t errors{0}, good{0}, bad{0}, resyncs{0}, discarded{0};
+    double seconds{0};
+};
+
+Result decode(const std::vector<float> &s, const std::vector<size_t> &injections, Mode mode)
+{
+    Result res;
+    std::vector<unsigned char> out(2 * kMessageBytes);
+    unsigned char expect[kMessageBytes];
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(out.data(), (uint32_t)out.size());
+    pd.setResyncOnError(mode == ON_ERROR);
+
+    auto start = std::chrono::steady_clock::now();
+    tipsy::DecoderEvent ev;
+    size_t next{0};
+    for (size_t b = 0; b < s.size(); b += kBlock)
+    {
+        auto n = std::min(kBlock, s.size() - b);
+        size_t i{0};
+        while (i < n)
+        {
+            auto stop = n;
+            if (mode == EXPLICIT && next < injections.size() && injections[next] < b + n)
+            {
+                if (injections[next] == b + i)
+                {
+                    pd.resync();
+                    next++;
+                    continue;
+                }
+                stop = injections[next] - b;
+            }
+
+            // one event at a time keeps the tallies below simple
+            if (pd.readFloats(s.data() + b + i, stop - i, &ev, 1) == 0)
+            {
+                i = stop;
+                continue;
+            }
+            i += ev.offset + 1;
+
+            if (tipsy::ProtocolDecoder::isError(ev.result))
+            {
+                res.errors++;
+            }
+            else if (ev.result == tipsy::DecoderResult::RESYNCED)
+            {
+                res.resyncs++;
+                res.discarded += pd.getDiscardedFloats();
+            }
+            else if (ev.result == tipsy::DecoderResult::BODY_READY && pd.isMessageComplete())
+            {
+                uint32_t m;
+                memcpy(&m, out.data(), sizeof(m));
+                payloadFor(m, expect);
+                auto ok = pd.getDataSize() == kMessageBytes &&
+                          memcmp(out.data(), expect, kMessageBytes) == 0;
+                res.good += ok;
+                res.bad += !ok;
+            }
+        }
+    }
+    res.seconds = std::chrono::duration<double>(std::chrono::steady_clock::now() - start).count();
+    return res;
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint32_t count = argc > 1 ? (uint32_t)strtoul(argv[1], nullptr, 10) : 20000;
+
+    printf("%u messages of %u bytes, one in %d damaged, %s kernels\n", count, kMessageBytes,
+           kDamageEvery, tipsy::simdLevelName(tipsy::activeKernels().level));
+    printf("damage       resync     errors     good      bad  discarded/resync  Mfloat/s\n");
+
+    for (int d = 0; d < N_DAMAGE; ++d)
+    {
+        std::vector<size_t> injections;
+        auto s = damagedStream(count, (Damage)d, injections);
+        for (int m = 0; m < N_MODES; ++m)
+        {
+            auto r = decode(s, injections, (Mode)m);
+            printf("%-12s %-8s %8llu %8llu %8llu  %16.1f  %8.1f\n", damageName[d], modeName[m],
+                   (unsigned long long)r.errors, (unsigned long long)r.good,
+                   (unsigned long long)r.bad, r.resyncs ? (double)r.discarded / r.resyncs : 0.0,
+                   s.size() / r.seconds * 1e-6);
+        }
+    }
+    return 0;
+}
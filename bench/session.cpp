@@ -0,0 +1,108 @@
+/*
+ * Small message rate: back to back 1 to 16 byte messages each with a full header against
+ * the same messages sent in a session, where all but the first carry only a size. Reports
+ * messages per second through encode and decode and the floats each message costs on the
+ * cable, which at a fixed sample rate is what really bounds the message rate.
+ *
+ * Usage: tipsy-encoder-bench-session [messages per size]
+ */
+
+#include "tipsy/tipsy.h"
+
+#include <chrono>
+#include <cstdio>
+#include <cstdlib>
+#include <vector>
+
+namespace
+{
+static constexpr size_t kBlock{64};
+static const char *kMimeType{"application/x-control-change"};
+
+// Encode and decode count messages of size bytes and return the floats they took
+template <typename Initiate>
+uint64_t run(tipsy::ProtocolEncoder &enc, Initiate initiate, uint64_t count, bool &ok)
+{
+    std::vector<float> buf(kBlock);
+    unsigned char out[32];
+    tipsy::ProtocolDecoder dec;
+    dec.provideDataBuffer(out, sizeof(out));
+
+    uint64_t floats{0}, bodies{0};
+    for (uint64_t m = 0; m < count; ++m)
+    {
+        if (!initiate(m))
+        {
+            ok = false;
+            return floats;
+        }
+        while (!enc.isDormant())
+        {
+            auto n = enc.getNextMessageFloats(buf.data(), buf.size());
+            floats += n;
+            for (size_t i = 0; i < n; ++i)
+            {
+                auto r = dec.readFloat(buf[i]);
+                if (tipsy::ProtocolDecoder::isError(r))
+                {
+                    ok = false;
+                    return floats;
+                }
+                bodies += r == tipsy::DecoderResult::BODY_READY;
+            }
+        }
+    }
+    ok = bodies == count;
+    return floats;
+}
+
+double seconds(std::chrono::steady_clock::time_point from)
+{
+    return std::chrono::duration<double>(std::chrono::steady_clock::now() - from).count();
+}
+} // namespace
+
+int main(int argc, char **argv)
+{
+    uint64_t count = argc > 1 ? strtoul(argv[1], nullptr, 10) : 1000000;
+    unsigned char payload[16];
+    for (int i = 0; i < 16; ++i)
+        payload[i] = (unsigned char)(i * 29 + 1);
+
+    printf("%llu messages per size, %s kernels\n", (unsigned long long)count,
+           tipsy::simdLevelName(tipsy::activeKernels().level));
+    printf("bytes   full Mmsg/s  floats   session Mmsg/s  floats\n");
+
+    for (uint32_t sz = 1; sz <= 16; ++sz)
+    {
+        bool fullOk{false}, sessionOk{false};
+
+        tipsy::ProtocolEncoder full;
+        auto start = std::chrono::steady_clock::now();
+        auto fullFloats = run(
+            full,
+            [&](uint64_t) {
+                return full.initiateMessage(kMimeType, sz, payload) ==
+                       tipsy::EncoderResult::MESSAGE_INITIATED;
+            },
+            count, fullOk);
+        auto fullT = seconds(start);
+
+        tipsy::ProtocolEncoder session;
+        start = std::chrono::steady_clock::now();
+        auto sessionFloats = run(
+            session,
+            [&](uint64_t m) {
+                auto r = m == 0 ? session.initiateSession(kMimeType, sz, payload)
+                                : session.initiateSessionMessage(sz, payload);
+                return r == tipsy::EncoderResult::MESSAGE_INITIATED;
+            },
+            count, sessionOk);
+        auto sessionT = seconds(start);
+
+        printf("%5u   %11.2f  %6.1f   %14.2f  %6.1f %s\n", sz, count / fullT * 1e-6,
+               (double)fullFloats / count, count / sessionT * 1e-6,
+               (double)sessionFloats / count, fullOk && sessionOk ? "" : "FAILED");
+    }
+    return 0;
+}
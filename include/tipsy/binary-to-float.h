@@ -12,7 +12,28 @@
  * An IEEE float is: lowest 23 bits are fraction, next 8 are exponent, last is sign bit.
  *
  */
+#include <cassert>
 #include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cstdlib>
+
+/*
+ * On x86 every SIMD variant of the bulk kernels is compiled regardless of the -m flags
+ * (using per function target attributes where the compiler needs them) and one is picked
+ * at runtime from cpuid. Elsewhere only the scalar kernels exist.
+ */
+#if defined(__x86_64__) || defined(_M_X64) || defined(__i386__) || defined(_M_IX86)
+#define TIPSY_X86 1
+#include <immintrin.h>
+#if defined(_MSC_VER) && !defined(__clang__)
+#include <intrin.h>
+#define TIPSY_TARGET(x)
+#else
+#include <cpuid.h>
+#define TIPSY_TARGET(x) __attribute__((target(x)))
+#endif
+#endif
 
 namespace tipsy
 {
@@ -22,6 +43,12 @@ constexpr const unsigned char LOW_7_MASK = 0x7f;
 constexpr const unsigned char BIT_8_MASK = 0x80;
 constexpr const unsigned char EXPONENT_FILL = 0x3f;
 
+// The same layout viewed as a little-endian 32 bit word, for the bulk kernels below
+constexpr const uint32_t WORD_LOW_23_MASK = 0x007fffff;
+constexpr const uint32_t WORD_BIT_24_MASK = 0x00800000;
+constexpr const uint32_t WORD_SIGN_MASK = 0x80000000;
+constexpr const uint32_t WORD_EXPONENT_FILL = (uint32_t)EXPONENT_FILL << 24;
+
 union FloatBytes
 {
     unsigned char bytes[4];
@@ -103,17 +130,1001 @@ inline float threeBytesToFloat(unsigned char b1, unsigned char b2, unsigned char
     return FloatBytes(b1, b2, b3).f;
 }
 
+// The same value as threeBytesToFloat, but computed arithmetically rather than through the
+// union so it can be used in constant expressions.
+constexpr float threeBytesToFloatConstexpr(unsigned char b1, unsigned char b2,
+                                           unsigned char b3) noexcept
+{
+    return ((b3 & BIT_8_MASK) ? -0.5f : 0.5f) *
+           (1.0f + (float)(b1 | (b2 << 8) | ((b3 & LOW_7_MASK) << 16)) / (float)(1 << 23));
+}
+
 inline unsigned char FirstByte(float f) noexcept { return FloatBytes(f).first(); }
 
 inline unsigned char SecondByte(float f) noexcept { return FloatBytes(f).second(); }
 
 inline unsigned char ThirdByte(float f) noexcept { return FloatBytes(f).third(); }
 
-inline float minimumEncodedFloat() noexcept { return FloatBytes(255, 255, 255).f; }
-inline float maximumEncodedFloat() noexcept { return FloatBytes(255, 255, 127).f; }
+// The extremes are FloatBytes(255, 255, 255) and FloatBytes(255, 255, 127), that is +/- the
+// largest float below 1. Spelling them as literals lets us skip the union in the hot checks.
+constexpr const float ENCODED_FLOAT_EXTREME = 1.0f - 1.0f / (float)(1 << 24);
+constexpr float minimumEncodedFloat() noexcept { return -ENCODED_FLOAT_EXTREME; }
+constexpr float maximumEncodedFloat() noexcept { return ENCODED_FLOAT_EXTREME; }
+// Every encoding carries the 0x3f exponent, so no data float is smaller than this in magnitude
+constexpr const float ENCODED_FLOAT_MINIMUM_MAGNITUDE = 0.5f;
 inline bool isValidDataEncoding(float f) noexcept
 {
     return (minimumEncodedFloat() <= f) && (f <= maximumEncodedFloat());
 }
+
+/*
+ * Bulk encoding. encodeBytesToFloats takes nBytes of data and writes (nBytes + 2) / 3 floats
+ * to out, returning that count. Each float is bit-identical to FloatBytes(b1, b2, b3) and a
+ * trailing partial group is zero padded, just like the per-float path in the encoder.
+ *
+ * Each kernel has a scalar version and on x86 SSE2, SSSE3, AVX2 and AVX-512 VBMI versions;
+ * the SIMD versions handle the bulk and hand whatever is left over to a narrower one.
+ * Which one runs is decided once at runtime, see SimdLevel below.
+ */
+namespace detail
+{
+inline size_t encodeBytesToFloatsScalar(const uint8_t *in, size_t nBytes, float *out) noexcept
+{
+    size_t o{0};
+    size_t i{0};
+    for (; i + 3 <= nBytes; i += 3)
+    {
+        out[o++] = FloatBytes(in[i], in[i + 1], in[i + 2]).f;
+    }
+    if (i < nBytes)
+    {
+        unsigned char d[3]{0, 0, 0};
+        for (int k = 0; i < nBytes; ++i, ++k)
+        {
+            d[k] = in[i];
+        }
+        out[o++] = FloatBytes(d[0], d[1], d[2]).f;
+    }
+    return o;
+}
+
+#if TIPSY_X86
+// Four floats per 12 bytes. SSE2 has no byte shuffle so we assemble the lanes from unaligned
+// word loads; each load reads one byte past its group so we stop 16 bytes short of the end.
+TIPSY_TARGET("sse2")
+inline size_t encodeBytesToFloatsSSE2(const uint8_t *in, size_t nBytes, float *out) noexcept
+{
+    const auto low = _mm_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto fill = _mm_set1_epi32((int)WORD_EXPONENT_FILL);
+
+    size_t i{0};
+    for (; i + 16 <= nBytes; i += 12)
+    {
+        uint32_t w[4];
+        for (int k = 0; k < 4; ++k)
+            memcpy(&w[k], in + i + 3 * k, sizeof(uint32_t));
+        auto v = _mm_set_epi32((int)w[3], (int)w[2], (int)w[1], (int)w[0]);
+        auto r = _mm_or_si128(_mm_and_si128(v, low), _mm_slli_epi32(_mm_and_si128(v, b24), 8));
+        _mm_storeu_si128((__m128i *)out, _mm_or_si128(r, fill));
+        out += 4;
+    }
+    return (i / 3) + encodeBytesToFloatsScalar(in + i, nBytes - i, out);
+}
+
+// 24 to 32 bit lane expansion: byte 3k, 3k+1, 3k+2 land in lane k with a zeroed top byte
+#define TIPSY_ENCODE_SHUFFLE_BYTES                                                                 \
+    (char)0x80, 11, 10, 9, (char)0x80, 8, 7, 6, (char)0x80, 5, 4, 3, (char)0x80, 2, 1, 0
+
+TIPSY_TARGET("ssse3")
+inline size_t encodeBytesToFloatsSSSE3(const uint8_t *in, size_t nBytes, float *out) noexcept
+{
+    const auto shuf = _mm_set_epi8(TIPSY_ENCODE_SHUFFLE_BYTES);
+    const auto low = _mm_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto fill = _mm_set1_epi32((int)WORD_EXPONENT_FILL);
+
+    size_t i{0};
+    for (; i + 16 <= nBytes; i += 12)
+    {
+        auto v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), shuf);
+        auto r = _mm_or_si128(_mm_and_si128(v, low), _mm_slli_epi32(_mm_and_si128(v, b24), 8));
+        _mm_storeu_si128((__m128i *)out, _mm_or_si128(r, fill));
+        out += 4;
+    }
+    return (i / 3) + encodeBytesToFloatsScalar(in + i, nBytes - i, out);
+}
+
+// Eight floats per 24 bytes; each 128 bit half is loaded 12 bytes apart so the in-lane
+// shuffle sees the same layout as the SSSE3 path.
+TIPSY_TARGET("avx2")
+inline size_t encodeBytesToFloatsAVX2(const uint8_t *in, size_t nBytes, float *out) noexcept
+{
+    const auto shuf = _mm256_set_epi8(TIPSY_ENCODE_SHUFFLE_BYTES, TIPSY_ENCODE_SHUFFLE_BYTES);
+    const auto low = _mm256_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm256_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto fill = _mm256_set1_epi32((int)WORD_EXPONENT_FILL);
+
+    size_t i{0};
+    for (; i + 28 <= nBytes; i += 24)
+    {
+        auto lo = _mm_loadu_si128((const __m128i *)(in + i));
+        auto hi = _mm_loadu_si128((const __m128i *)(in + i + 12));
+        auto v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        auto r = _mm256_or_si256(_mm256_and_si256(v, low),
+                                 _mm256_slli_epi32(_mm256_and_si256(v, b24), 8));
+        _mm256_storeu_si256((__m256i *)out, _mm256_or_si256(r, fill));
+        out += 8;
+    }
+    return (i / 3) + encodeBytesToFloatsSSSE3(in + i, nBytes - i, out);
+}
+
+// Sixteen floats per 48 bytes. The masked load never reads past the group and vpermb does
+// the whole 24 to 32 bit expansion across the register in one step.
+#define TIPSY_AVX512_48_BYTE_MASK ((__mmask64)0xFFFFFFFFFFFFull)
+// The unmasked forms of some AVX-512 intrinsics merge into an undefined register, which
+// GCC 12 warns may be uninitialized at -O2 -Wall in every caller; the all ones maskz forms
+// compile to the same instructions without it
+#define TIPSY_AVX512_ALL_BYTES ((__mmask64)~0ull)
+#define TIPSY_AVX512_ALL_LANES ((__mmask16)0xFFFF)
+
+TIPSY_TARGET("avx512f,avx512bw,avx512vbmi")
+inline size_t encodeBytesToFloatsAVX512VBMI(const uint8_t *in, size_t nBytes, float *out) noexcept
+{
+    alignas(64) static const uint8_t expand[64]{
+        0,  1,  2,  2,  3,  4,  5,  5,  6,  7,  8,  8,  9,  10, 11, 11, 12, 13, 14, 14, 15, 16,
+        17, 17, 18, 19, 20, 20, 21, 22, 23, 23, 24, 25, 26, 26, 27, 28, 29, 29, 30, 31, 32, 32,
+        33, 34, 35, 35, 36, 37, 38, 38, 39, 40, 41, 41, 42, 43, 44, 44, 45, 46, 47, 47};
+    const auto perm = _mm512_load_si512((const void *)expand);
+    const auto low = _mm512_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm512_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto fill = _mm512_set1_epi32((int)WORD_EXPONENT_FILL);
+
+    size_t i{0};
+    for (; i + 48 <= nBytes; i += 48)
+    {
+        auto v = _mm512_maskz_loadu_epi8(TIPSY_AVX512_48_BYTE_MASK, in + i);
+        v = _mm512_maskz_permutexvar_epi8(TIPSY_AVX512_ALL_BYTES, perm, v);
+        auto r = _mm512_or_si512(
+            _mm512_and_si512(v, low),
+            _mm512_maskz_slli_epi32(TIPSY_AVX512_ALL_LANES, _mm512_and_si512(v, b24), 8));
+        _mm512_storeu_si512((void *)out, _mm512_or_si512(r, fill));
+        out += 16;
+    }
+    return (i / 3) + encodeBytesToFloatsAVX2(in + i, nBytes - i, out);
+}
+#endif
+
+/*
+ * And the inverse. The SIMD paths recover the 24 payload bits in each lane, folding the
+ * float sign bit back down into bit 24, and then compact the lanes to 3 bytes each.
+ */
+inline void decodeFloatsToBytesScalar(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    for (size_t i = 0; i < nFloats; ++i)
+    {
+        auto fb = FloatBytes(in[i]);
+        out[0] = fb.first();
+        out[1] = fb.second();
+        out[2] = fb.third();
+        out += 3;
+    }
+}
+
+#if TIPSY_X86
+TIPSY_TARGET("sse2")
+inline void decodeFloatsToBytesSSE2(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    const auto low = _mm_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm_set1_epi32((int)WORD_BIT_24_MASK);
+
+    size_t i{0};
+    for (; i + 4 <= nFloats; i += 4)
+    {
+        auto u = _mm_loadu_si128((const __m128i *)(in + i));
+        auto v = _mm_or_si128(_mm_and_si128(u, low), _mm_and_si128(_mm_srli_epi32(u, 8), b24));
+        uint32_t w[4];
+        _mm_storeu_si128((__m128i *)w, v);
+        for (int k = 0; k < 4; ++k)
+        {
+            out[0] = w[k] & BYTE_MASK;
+            out[1] = (w[k] >> 8) & BYTE_MASK;
+            out[2] = (w[k] >> 16) & BYTE_MASK;
+            out += 3;
+        }
+    }
+    decodeFloatsToBytesScalar(in + i, nFloats - i, out);
+}
+
+// 32 to 24 bit compaction: the low three bytes of each lane packed into the low 12 bytes
+#define TIPSY_DECODE_SHUFFLE_BYTES                                                                 \
+    (char)0x80, (char)0x80, (char)0x80, (char)0x80, 14, 13, 12, 10, 9, 8, 6, 5, 4, 2, 1, 0
+
+// Each step stores 16 bytes of which 12 are kept, so stop while 16 output bytes remain
+TIPSY_TARGET("ssse3")
+inline void decodeFloatsToBytesSSSE3(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    const auto shuf = _mm_set_epi8(TIPSY_DECODE_SHUFFLE_BYTES);
+    const auto low = _mm_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm_set1_epi32((int)WORD_BIT_24_MASK);
+
+    size_t i{0};
+    for (; (nFloats - i) * 3 >= 16; i += 4)
+    {
+        auto u = _mm_loadu_si128((const __m128i *)(in + i));
+        auto v = _mm_or_si128(_mm_and_si128(u, low), _mm_and_si128(_mm_srli_epi32(u, 8), b24));
+        _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(v, shuf));
+        out += 12;
+    }
+    decodeFloatsToBytesScalar(in + i, nFloats - i, out);
+}
+
+TIPSY_TARGET("avx2")
+inline void decodeFloatsToBytesAVX2(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    const auto shuf = _mm256_set_epi8(TIPSY_DECODE_SHUFFLE_BYTES, TIPSY_DECODE_SHUFFLE_BYTES);
+    const auto low = _mm256_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm256_set1_epi32((int)WORD_BIT_24_MASK);
+
+    size_t i{0};
+    for (; (nFloats - i) * 3 >= 28; i += 8)
+    {
+        auto u = _mm256_loadu_si256((const __m256i *)(in + i));
+        auto v = _mm256_or_si256(_mm256_and_si256(u, low),
+                                 _mm256_and_si256(_mm256_srli_epi32(u, 8), b24));
+        v = _mm256_shuffle_epi8(v, shuf);
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i *)(out + 12), _mm256_extracti128_si256(v, 1));
+        out += 24;
+    }
+    decodeFloatsToBytesSSSE3(in + i, nFloats - i, out);
+}
+
+TIPSY_TARGET("avx512f,avx512bw,avx512vbmi")
+inline void decodeFloatsToBytesAVX512VBMI(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    alignas(64) static const uint8_t compact[64]{
+        0,  1,  2,  4,  5,  6,  8,  9,  10, 12, 13, 14, 16, 17, 18, 20, 21, 22, 24, 25, 26, 28,
+        29, 30, 32, 33, 34, 36, 37, 38, 40, 41, 42, 44, 45, 46, 48, 49, 50, 52, 53, 54, 56, 57,
+        58, 60, 61, 62, 0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0,  0};
+    const auto perm = _mm512_load_si512((const void *)compact);
+    const auto low = _mm512_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm512_set1_epi32((int)WORD_BIT_24_MASK);
+
+    size_t i{0};
+    for (; i + 16 <= nFloats; i += 16)
+    {
+        auto u = _mm512_loadu_si512((const void *)(in + i));
+        auto v = _mm512_or_si512(
+            _mm512_and_si512(u, low),
+            _mm512_and_si512(_mm512_maskz_srli_epi32(TIPSY_AVX512_ALL_LANES, u, 8), b24));
+        v = _mm512_maskz_permutexvar_epi8(TIPSY_AVX512_ALL_BYTES, perm, v);
+        _mm512_mask_storeu_epi8(out, TIPSY_AVX512_48_BYTE_MASK, v);
+        out += 48;
+    }
+    decodeFloatsToBytesAVX2(in + i, nFloats - i, out);
+}
+#endif
+} // namespace detail
+
+/*
+ * The dense (protocol version 2) encoding. Rather than pinning the exponent we let the top
+ * 4 payload bits choose one of 16 exponents, so each float carries 28 bits with a magnitude
+ * in [2^-15, 2). That keeps well clear of denormals, which hosts may flush, and of the
+ * sentinels, and means 7 bytes go in a pair of floats rather than 6.
+ *
+ * Within a pair each float carries 3 bytes exactly as FloatBytes does, in the low 24 bits,
+ * and byte 6 is split across the two exponent nibbles, low nibble first. A trailing partial
+ * pair is zero padded, so the encoding of nBytes is always 2 * ceil(nBytes / 7) floats.
+ */
+constexpr const uint32_t DENSE_EXPONENT_BASE = 112;
+constexpr const uint32_t DENSE_NIBBLE_MASK = 0x0f;
+constexpr const float DENSE_MINIMUM_MAGNITUDE = 1.0f / (float)(1 << 15);
+constexpr const float DENSE_MAXIMUM_MAGNITUDE = 2.0f - 1.0f / (float)(1 << 23);
+
+inline bool isValidDenseDataEncoding(float f) noexcept
+{
+    auto a = f < 0 ? -f : f;
+    return DENSE_MINIMUM_MAGNITUDE <= a && a <= DENSE_MAXIMUM_MAGNITUDE;
+}
+
+inline float denseWordToFloat(uint32_t payload) noexcept
+{
+    uint32_t u = (payload & WORD_LOW_23_MASK) | ((payload & WORD_BIT_24_MASK) << 8) |
+                 ((DENSE_EXPONENT_BASE + (payload >> 24)) << 23);
+    float f;
+    memcpy(&f, &u, sizeof(float));
+    return f;
+}
+
+inline uint32_t denseFloatToWord(float f) noexcept
+{
+    uint32_t u;
+    memcpy(&u, &f, sizeof(float));
+    auto nibble = (((u >> 23) & BYTE_MASK) - DENSE_EXPONENT_BASE) & DENSE_NIBBLE_MASK;
+    return (u & WORD_LOW_23_MASK) | ((u >> 8) & WORD_BIT_24_MASK) | (nibble << 24);
+}
+
+/*
+ * The dense kernels. A 16 byte load holds two whole 7 byte pairs, so the SIMD paths
+ * shuffle each 3 byte half and the shared byte 6 into a lane and then fix up the nibble;
+ * since DENSE_EXPONENT_BASE is a multiple of 16 the nibble is just the low 4 exponent
+ * bits. Without pshufb there is nothing to gain, so SSE2 uses the scalar versions, and
+ * AVX-512 the AVX2 ones.
+ */
+namespace detail
+{
+// Returns the number of floats written, 2 * ceil(nBytes / 7)
+inline size_t encodeBytesToFloatsDenseScalar(const uint8_t *in, size_t nBytes,
+                                             float *out) noexcept
+{
+    size_t o{0};
+    for (size_t i = 0; i < nBytes; i += 7)
+    {
+        uint8_t d[7]{0, 0, 0, 0, 0, 0, 0};
+        if (i + 7 <= nBytes)
+            memcpy(d, in + i, 7);
+        else
+            memcpy(d, in + i, nBytes - i);
+
+        uint32_t a = d[0] | (d[1] << 8) | (d[2] << 16) | ((d[6] & DENSE_NIBBLE_MASK) << 24);
+        uint32_t b = d[3] | (d[4] << 8) | (d[5] << 16) | ((uint32_t)(d[6] >> 4) << 24);
+        out[o++] = denseWordToFloat(a);
+        out[o++] = denseWordToFloat(b);
+    }
+    return o;
+}
+
+// nFloats must be even; writes exactly 7 * nFloats / 2 bytes to out
+inline void decodeFloatsToBytesDenseScalar(const float *in, size_t nFloats,
+                                           uint8_t *out) noexcept
+{
+    for (size_t i = 0; i + 2 <= nFloats; i += 2)
+    {
+        auto a = denseFloatToWord(in[i]);
+        auto b = denseFloatToWord(in[i + 1]);
+        out[0] = a & BYTE_MASK;
+        out[1] = (a >> 8) & BYTE_MASK;
+        out[2] = (a >> 16) & BYTE_MASK;
+        out[3] = b & BYTE_MASK;
+        out[4] = (b >> 8) & BYTE_MASK;
+        out[5] = (b >> 16) & BYTE_MASK;
+        out[6] = (uint8_t)((a >> 24) | ((b >> 24) << 4));
+        out += 7;
+    }
+}
+
+#if TIPSY_X86
+// Pair p of the load lands in lanes 2p and 2p + 1 as its 3 byte half with byte 6 on top
+#define TIPSY_DENSE_ENCODE_SHUFFLE_BYTES 13, 12, 11, 10, 13, 9, 8, 7, 6, 5, 4, 3, 6, 2, 1, 0
+
+// Four floats per 14 bytes; each load reads two bytes past its pairs
+TIPSY_TARGET("ssse3")
+inline size_t encodeBytesToFloatsDenseSSSE3(const uint8_t *in, size_t nBytes,
+                                            float *out) noexcept
+{
+    const auto shuf = _mm_set_epi8(TIPSY_DENSE_ENCODE_SHUFFLE_BYTES);
+    const auto low = _mm_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto nib = _mm_set1_epi32((int)DENSE_NIBBLE_MASK);
+    const auto odd = _mm_set_epi32(-1, 0, -1, 0);
+    const auto base = _mm_set1_epi32((int)DENSE_EXPONENT_BASE);
+
+    size_t i{0};
+    for (; i + 16 <= nBytes; i += 14)
+    {
+        auto v = _mm_shuffle_epi8(_mm_loadu_si128((const __m128i *)(in + i)), shuf);
+        // byte 6 is on top of both lanes of a pair: low nibble for the first, high the second
+        auto top = _mm_srli_epi32(v, 24);
+        auto n = _mm_and_si128(
+            _mm_or_si128(_mm_andnot_si128(odd, top), _mm_and_si128(odd, _mm_srli_epi32(top, 4))),
+            nib);
+        auto r = _mm_or_si128(_mm_and_si128(v, low), _mm_slli_epi32(_mm_and_si128(v, b24), 8));
+        r = _mm_or_si128(r, _mm_slli_epi32(_mm_or_si128(n, base), 23));
+        _mm_storeu_si128((__m128i *)out, r);
+        out += 4;
+    }
+    return (i / 7) * 2 + encodeBytesToFloatsDenseScalar(in + i, nBytes - i, out);
+}
+
+// Eight floats per 28 bytes, each 128 bit half loaded 14 bytes apart
+TIPSY_TARGET("avx2")
+inline size_t encodeBytesToFloatsDenseAVX2(const uint8_t *in, size_t nBytes,
+                                           float *out) noexcept
+{
+    const auto shuf =
+        _mm256_set_epi8(TIPSY_DENSE_ENCODE_SHUFFLE_BYTES, TIPSY_DENSE_ENCODE_SHUFFLE_BYTES);
+    const auto low = _mm256_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm256_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto nib = _mm256_set1_epi32((int)DENSE_NIBBLE_MASK);
+    const auto shift = _mm256_set_epi32(28, 24, 28, 24, 28, 24, 28, 24);
+    const auto base = _mm256_set1_epi32((int)DENSE_EXPONENT_BASE);
+
+    size_t i{0};
+    for (; i + 30 <= nBytes; i += 28)
+    {
+        auto lo = _mm_loadu_si128((const __m128i *)(in + i));
+        auto hi = _mm_loadu_si128((const __m128i *)(in + i + 14));
+        auto v = _mm256_inserti128_si256(_mm256_castsi128_si256(lo), hi, 1);
+        v = _mm256_shuffle_epi8(v, shuf);
+        auto n = _mm256_and_si256(_mm256_srlv_epi32(v, shift), nib);
+        auto r = _mm256_or_si256(_mm256_and_si256(v, low),
+                                 _mm256_slli_epi32(_mm256_and_si256(v, b24), 8));
+        r = _mm256_or_si256(r, _mm256_slli_epi32(_mm256_or_si256(n, base), 23));
+        _mm256_storeu_si256((__m256i *)out, r);
+        out += 8;
+    }
+    return (i / 7) * 2 + encodeBytesToFloatsDenseSSSE3(in + i, nBytes - i, out);
+}
+
+/*
+ * Decode folds each odd lane's nibble into the byte above its even lane with one 64 bit
+ * shift, then compacts to 7 bytes a pair: the even lane's 3 bytes, the odd lane's 3 bytes
+ * and that combined byte.
+ */
+#define TIPSY_DENSE_DECODE_SHUFFLE_BYTES                                                           \
+    (char)0x80, (char)0x80, 11, 14, 13, 12, 10, 9, 8, 3, 6, 5, 4, 2, 1, 0
+
+// Each step stores 16 bytes of which 14 are kept, so stop while 16 output bytes remain
+TIPSY_TARGET("ssse3")
+inline void decodeFloatsToBytesDenseSSSE3(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    const auto shuf = _mm_set_epi8(TIPSY_DENSE_DECODE_SHUFFLE_BYTES);
+    const auto low = _mm_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto nib = _mm_set1_epi32((int)DENSE_NIBBLE_MASK);
+    const auto byte = _mm_set1_epi64x(BYTE_MASK);
+
+    size_t i{0};
+    for (; i + 6 <= nFloats; i += 4)
+    {
+        auto u = _mm_loadu_si128((const __m128i *)(in + i));
+        auto v = _mm_or_si128(_mm_and_si128(u, low), _mm_and_si128(_mm_srli_epi32(u, 8), b24));
+        auto n = _mm_and_si128(_mm_srli_epi32(u, 23), nib);
+        auto c = _mm_and_si128(_mm_or_si128(n, _mm_srli_epi64(n, 28)), byte);
+        v = _mm_or_si128(v, _mm_slli_epi64(c, 24));
+        _mm_storeu_si128((__m128i *)out, _mm_shuffle_epi8(v, shuf));
+        out += 14;
+    }
+    decodeFloatsToBytesDenseScalar(in + i, nFloats - i, out);
+}
+
+TIPSY_TARGET("avx2")
+inline void decodeFloatsToBytesDenseAVX2(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    const auto shuf =
+        _mm256_set_epi8(TIPSY_DENSE_DECODE_SHUFFLE_BYTES, TIPSY_DENSE_DECODE_SHUFFLE_BYTES);
+    const auto low = _mm256_set1_epi32((int)WORD_LOW_23_MASK);
+    const auto b24 = _mm256_set1_epi32((int)WORD_BIT_24_MASK);
+    const auto nib = _mm256_set1_epi32((int)DENSE_NIBBLE_MASK);
+    const auto byte = _mm256_set1_epi64x(BYTE_MASK);
+
+    size_t i{0};
+    for (; i + 10 <= nFloats; i += 8)
+    {
+        auto u = _mm256_loadu_si256((const __m256i *)(in + i));
+        auto v = _mm256_or_si256(_mm256_and_si256(u, low),
+                                 _mm256_and_si256(_mm256_srli_epi32(u, 8), b24));
+        auto n = _mm256_and_si256(_mm256_srli_epi32(u, 23), nib);
+        auto c = _mm256_and_si256(_mm256_or_si256(n, _mm256_srli_epi64(n, 28)), byte);
+        v = _mm256_shuffle_epi8(_mm256_or_si256(v, _mm256_slli_epi64(c, 24)), shuf);
+        _mm_storeu_si128((__m128i *)out, _mm256_castsi256_si128(v));
+        _mm_storeu_si128((__m128i *)(out + 14), _mm256_extracti128_si256(v, 1));
+        out += 28;
+    }
+    decodeFloatsToBytesDenseSSSE3(in + i, nFloats - i, out);
+}
+#endif
+
+/*
+ * Stream validation. validateFloats returns the index of the first float which is neither
+ * a data float, with minMagnitude <= |f| <= maxMagnitude, nor exactly one of the nSentinels
+ * (at most kMaxValidateSentinels) values, or n if there is none. When sentinelMask is non
+ * null bit i % 64 of word i / 64 is or-ed in for every sentinel before that index; clearing
+ * the words first is up to the caller.
+ */
+static constexpr size_t kMaxValidateSentinels{8};
+
+inline size_t validateFloatsFrom(const float *f, size_t i, size_t n, float minMagnitude,
+                                 float maxMagnitude, const float *sentinels, size_t nSentinels,
+                                 uint64_t *sentinelMask) noexcept
+{
+    for (; i < n; ++i)
+    {
+        bool isSentinel{false};
+        for (size_t s = 0; s < nSentinels; ++s)
+            isSentinel = isSentinel | (f[i] == sentinels[s]);
+
+        if (isSentinel)
+        {
+            if (sentinelMask)
+                sentinelMask[i / 64] |= (uint64_t)1 << (i % 64);
+        }
+        else
+        {
+            auto a = f[i] < 0 ? -f[i] : f[i];
+            if (!(minMagnitude <= a && a <= maxMagnitude))
+                return i;
+        }
+    }
+    return n;
+}
+
+inline size_t validateFloatsScalar(const float *f, size_t n, float minMagnitude,
+                                   float maxMagnitude, const float *sentinels, size_t nSentinels,
+                                   uint64_t *sentinelMask) noexcept
+{
+    return validateFloatsFrom(f, 0, n, minMagnitude, maxMagnitude, sentinels, nSentinels,
+                              sentinelMask);
+}
+
+// bits must be non zero
+inline size_t firstSetBit(uint32_t bits) noexcept
+{
+    size_t r{0};
+    while (!(bits & (1u << r)))
+        r++;
+    return r;
+}
+
+// The SIMD versions work in blocks of 4, 8 or 16 floats, which never straddle a mask word.
+// When a block has an invalid float this records the sentinels ahead of it and returns
+// its offset within the block.
+inline size_t finishFailedBlock(size_t i, uint32_t okBits, uint32_t sentinelBits,
+                                uint64_t *sentinelMask) noexcept
+{
+    auto bad = firstSetBit(~okBits);
+    if (sentinelMask)
+        sentinelMask[i / 64] |= (uint64_t)(sentinelBits & ((1u << bad) - 1)) << (i % 64);
+    return bad;
+}
+
+#if TIPSY_X86
+TIPSY_TARGET("sse2")
+inline size_t validateFloatsSSE2(const float *f, size_t n, float minMagnitude,
+                                 float maxMagnitude, const float *sentinels, size_t nSentinels,
+                                 uint64_t *sentinelMask) noexcept
+{
+    const auto lo = _mm_set1_ps(minMagnitude);
+    const auto hi = _mm_set1_ps(maxMagnitude);
+    const auto absMask = _mm_castsi128_ps(_mm_set1_epi32((int)~WORD_SIGN_MASK));
+    __m128 sv[kMaxValidateSentinels];
+    for (size_t s = 0; s < nSentinels; ++s)
+        sv[s] = _mm_set1_ps(sentinels[s]);
+
+    size_t i{0};
+    for (; i + 4 <= n; i += 4)
+    {
+        auto v = _mm_loadu_ps(f + i);
+        auto a = _mm_and_ps(v, absMask);
+        auto isData = _mm_and_ps(_mm_cmpge_ps(a, lo), _mm_cmple_ps(a, hi));
+        auto isSentinel = _mm_setzero_ps();
+        for (size_t s = 0; s < nSentinels; ++s)
+            isSentinel = _mm_or_ps(isSentinel, _mm_cmpeq_ps(v, sv[s]));
+
+        auto ok = (uint32_t)_mm_movemask_ps(_mm_or_ps(isData, isSentinel));
+        auto sb = (uint32_t)_mm_movemask_ps(isSentinel);
+        if (ok != 0xF)
+            return i + finishFailedBlock(i, ok, sb, sentinelMask);
+        if (sentinelMask)
+            sentinelMask[i / 64] |= (uint64_t)sb << (i % 64);
+    }
+    return validateFloatsFrom(f, i, n, minMagnitude, maxMagnitude, sentinels, nSentinels,
+                              sentinelMask);
+}
+
+TIPSY_TARGET("avx2")
+inline size_t validateFloatsAVX2(const float *f, size_t n, float minMagnitude,
+                                 float maxMagnitude, const float *sentinels, size_t nSentinels,
+                                 uint64_t *sentinelMask) noexcept
+{
+    const auto lo = _mm256_set1_ps(minMagnitude);
+    const auto hi = _mm256_set1_ps(maxMagnitude);
+    const auto absMask = _mm256_castsi256_ps(_mm256_set1_epi32((int)~WORD_SIGN_MASK));
+    __m256 sv[kMaxValidateSentinels];
+    for (size_t s = 0; s < nSentinels; ++s)
+        sv[s] = _mm256_set1_ps(sentinels[s]);
+
+    size_t i{0};
+    for (; i + 8 <= n; i += 8)
+    {
+        auto v = _mm256_loadu_ps(f + i);
+        auto a = _mm256_and_ps(v, absMask);
+        auto isData = _mm256_and_ps(_mm256_cmp_ps(a, lo, _CMP_GE_OQ),
+                                    _mm256_cmp_ps(a, hi, _CMP_LE_OQ));
+        auto isSentinel = _mm256_setzero_ps();
+        for (size_t s = 0; s < nSentinels; ++s)
+            isSentinel = _mm256_or_ps(isSentinel, _mm256_cmp_ps(v, sv[s], _CMP_EQ_OQ));
+
+        auto ok = (uint32_t)_mm256_movemask_ps(_mm256_or_ps(isData, isSentinel));
+        auto sb = (uint32_t)_mm256_movemask_ps(isSentinel);
+        if (ok != 0xFF)
+            return i + finishFailedBlock(i, ok, sb, sentinelMask);
+        if (sentinelMask)
+            sentinelMask[i / 64] |= (uint64_t)sb << (i % 64);
+    }
+    return validateFloatsFrom(f, i, n, minMagnitude, maxMagnitude, sentinels, nSentinels,
+                              sentinelMask);
+}
+
+TIPSY_TARGET("avx512f,avx512bw,avx512vbmi")
+inline size_t validateFloatsAVX512VBMI(const float *f, size_t n, float minMagnitude,
+                                       float maxMagnitude, const float *sentinels,
+                                       size_t nSentinels, uint64_t *sentinelMask) noexcept
+{
+    const auto lo = _mm512_set1_ps(minMagnitude);
+    const auto hi = _mm512_set1_ps(maxMagnitude);
+    __m512 sv[kMaxValidateSentinels];
+    for (size_t s = 0; s < nSentinels; ++s)
+        sv[s] = _mm512_set1_ps(sentinels[s]);
+
+    size_t i{0};
+    for (; i + 16 <= n; i += 16)
+    {
+        auto v = _mm512_loadu_ps(f + i);
+        auto a = _mm512_abs_ps(v);
+        auto isData = _mm512_cmp_ps_mask(a, lo, _CMP_GE_OQ) & _mm512_cmp_ps_mask(a, hi, _CMP_LE_OQ);
+        __mmask16 isSentinel{0};
+        for (size_t s = 0; s < nSentinels; ++s)
+            isSentinel |= _mm512_cmp_ps_mask(v, sv[s], _CMP_EQ_OQ);
+
+        auto ok = (uint32_t)(isData | isSentinel);
+        if (ok != 0xFFFF)
+            return i + finishFailedBlock(i, ok, (uint32_t)isSentinel, sentinelMask);
+        if (sentinelMask)
+            sentinelMask[i / 64] |= (uint64_t)isSentinel << (i % 64);
+    }
+    return validateFloatsFrom(f, i, n, minMagnitude, maxMagnitude, sentinels, nSentinels,
+                              sentinelMask);
+}
+#endif
+
+/*
+ * Range scan. findFloatInRange returns the index of the first float in [lo, hi], or n if
+ * there is none. NaNs are never in range. This is how idle input gets skipped quickly.
+ */
+inline size_t findFloatInRangeScalar(const float *f, size_t n, float lo, float hi) noexcept
+{
+    for (size_t i = 0; i < n; ++i)
+    {
+        if (lo <= f[i] && f[i] <= hi)
+            return i;
+    }
+    return n;
+}
+
+#if TIPSY_X86
+TIPSY_TARGET("sse2")
+inline size_t findFloatInRangeSSE2(const float *f, size_t n, float lo, float hi) noexcept
+{
+    const auto vlo = _mm_set1_ps(lo);
+    const auto vhi = _mm_set1_ps(hi);
+
+    size_t i{0};
+    for (; i + 4 <= n; i += 4)
+    {
+        auto v = _mm_loadu_ps(f + i);
+        auto in = (uint32_t)_mm_movemask_ps(_mm_and_ps(_mm_cmpge_ps(v, vlo), _mm_cmple_ps(v, vhi)));
+        if (in)
+            return i + firstSetBit(in);
+    }
+    return i + findFloatInRangeScalar(f + i, n - i, lo, hi);
+}
+
+TIPSY_TARGET("avx2")
+inline size_t findFloatInRangeAVX2(const float *f, size_t n, float lo, float hi) noexcept
+{
+    const auto vlo = _mm256_set1_ps(lo);
+    const auto vhi = _mm256_set1_ps(hi);
+
+    size_t i{0};
+    for (; i + 8 <= n; i += 8)
+    {
+        auto v = _mm256_loadu_ps(f + i);
+        auto in = (uint32_t)_mm256_movemask_ps(
+            _mm256_and_ps(_mm256_cmp_ps(v, vlo, _CMP_GE_OQ), _mm256_cmp_ps(v, vhi, _CMP_LE_OQ)));
+        if (in)
+            return i + firstSetBit(in);
+    }
+    return i + findFloatInRangeScalar(f + i, n - i, lo, hi);
+}
+
+TIPSY_TARGET("avx512f,avx512bw,avx512vbmi")
+inline size_t findFloatInRangeAVX512VBMI(const float *f, size_t n, float lo, float hi) noexcept
+{
+    const auto vlo = _mm512_set1_ps(lo);
+    const auto vhi = _mm512_set1_ps(hi);
+
+    size_t i{0};
+    for (; i + 16 <= n; i += 16)
+    {
+        auto v = _mm512_loadu_ps(f + i);
+        auto in = (uint32_t)(_mm512_cmp_ps_mask(v, vlo, _CMP_GE_OQ) &
+                             _mm512_cmp_ps_mask(v, vhi, _CMP_LE_OQ));
+        if (in)
+            return i + firstSetBit(in);
+    }
+    return i + findFloatInRangeScalar(f + i, n - i, lo, hi);
+}
+#endif
+} // namespace detail
+
+/*
+ * Runtime kernel selection. We probe cpuid once, on first use, and pick the widest level
+ * the CPU and OS support. Setting the environment variable TIPSY_SIMD_LEVEL to one of
+ * scalar, sse2, ssse3, avx2 or avx512vbmi caps the level, which is handy for benchmarking;
+ * asking for more than the machine supports just gets you the detected level.
+ */
+enum class SimdLevel : uint8_t
+{
+    SCALAR,
+    SSE2,
+    SSSE3,
+    AVX2,
+    AVX512_VBMI
+};
+
+inline const char *simdLevelName(SimdLevel l) noexcept
+{
+    switch (l)
+    {
+    case SimdLevel::SCALAR:
+        return "scalar";
+    case SimdLevel::SSE2:
+        return "sse2";
+    case SimdLevel::SSSE3:
+        return "ssse3";
+    case SimdLevel::AVX2:
+        return "avx2";
+    case SimdLevel::AVX512_VBMI:
+        return "avx512vbmi";
+    }
+    return "ERROR";
+}
+
+namespace detail
+{
+#if TIPSY_X86
+inline void cpuid(uint32_t leaf, uint32_t sub, uint32_t r[4]) noexcept
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    int q[4];
+    __cpuidex(q, (int)leaf, (int)sub);
+    for (int i = 0; i < 4; ++i)
+        r[i] = (uint32_t)q[i];
+#else
+    __cpuid_count(leaf, sub, r[0], r[1], r[2], r[3]);
+#endif
+}
+
+inline uint64_t xgetbv0() noexcept
+{
+#if defined(_MSC_VER) && !defined(__clang__)
+    return _xgetbv(0);
+#else
+    uint32_t lo, hi;
+    __asm__ volatile("xgetbv" : "=a"(lo), "=d"(hi) : "c"(0));
+    return ((uint64_t)hi << 32) | lo;
+#endif
+}
+#endif
+} // namespace detail
+
+inline SimdLevel detectSimdLevel() noexcept
+{
+#if TIPSY_X86
+    uint32_t r[4];
+    detail::cpuid(0, 0, r);
+    auto maxLeaf = r[0];
+
+    detail::cpuid(1, 0, r);
+    auto ecx1 = r[2], edx1 = r[3];
+    if (!(edx1 & (1u << 26)))
+        return SimdLevel::SCALAR;
+    if (!(ecx1 & (1u << 9)))
+        return SimdLevel::SSE2;
+
+    // AVX needs OSXSAVE and the OS saving the xmm and ymm state
+    bool osxsave = (ecx1 & (1u << 27)) && (ecx1 & (1u << 28));
+    if (!osxsave || maxLeaf < 7)
+        return SimdLevel::SSSE3;
+    auto xcr0 = detail::xgetbv0();
+    if ((xcr0 & 0x6) != 0x6)
+        return SimdLevel::SSSE3;
+
+    detail::cpuid(7, 0, r);
+    auto ebx7 = r[1], ecx7 = r[2];
+    if (!(ebx7 & (1u << 5)))
+        return SimdLevel::SSSE3;
+
+    // AVX-512 also needs the opmask and zmm state enabled, and F + BW + VBMI
+    bool zmm = (xcr0 & 0xE6) == 0xE6;
+    if (zmm && (ebx7 & (1u << 16)) && (ebx7 & (1u << 30)) && (ecx7 & (1u << 1)))
+        return SimdLevel::AVX512_VBMI;
+    return SimdLevel::AVX2;
+#else
+    return SimdLevel::SCALAR;
+#endif
+}
+
+inline SimdLevel selectSimdLevel() noexcept
+{
+    auto detected = detectSimdLevel();
+    auto req = getenv("TIPSY_SIMD_LEVEL");
+    if (!req)
+        return detected;
+
+    for (int i = 0; i <= (int)SimdLevel::AVX512_VBMI; ++i)
+    {
+        auto l = (SimdLevel)i;
+        if (strcmp(req, simdLevelName(l)) == 0)
+            return l < detected ? l : detected;
+    }
+    return detected;
+}
+
+struct KernelTable
+{
+    SimdLevel level;
+    size_t (*encodeBytesToFloats)(const uint8_t *in, size_t nBytes, float *out);
+    void (*decodeFloatsToBytes)(const float *in, size_t nFloats, uint8_t *out);
+    size_t (*validateFloats)(const float *f, size_t n, float minMagnitude, float maxMagnitude,
+                             const float *sentinels, size_t nSentinels, uint64_t *sentinelMask);
+    size_t (*findFloatInRange)(const float *f, size_t n, float lo, float hi);
+    size_t (*encodeBytesToFloatsDense)(const uint8_t *in, size_t nBytes, float *out);
+    void (*decodeFloatsToBytesDense)(const float *in, size_t nFloats, uint8_t *out);
+};
+
+// The kernels for a given level. Calling the result with a level above detectSimdLevel()
+// will fault, so outside of tests you want activeKernels() below.
+inline KernelTable kernelsForLevel(SimdLevel l) noexcept
+{
+    switch (l)
+    {
+#if TIPSY_X86
+    case SimdLevel::SSE2:
+        return {l,
+                detail::encodeBytesToFloatsSSE2,
+                detail::decodeFloatsToBytesSSE2,
+                detail::validateFloatsSSE2,
+                detail::findFloatInRangeSSE2,
+                detail::encodeBytesToFloatsDenseScalar,
+                detail::decodeFloatsToBytesDenseScalar};
+    case SimdLevel::SSSE3:
+        // neither validation nor the range scan has anything to gain from pshufb
+        return {l,
+                detail::encodeBytesToFloatsSSSE3,
+                detail::decodeFloatsToBytesSSSE3,
+                detail::validateFloatsSSE2,
+                detail::findFloatInRangeSSE2,
+                detail::encodeBytesToFloatsDenseSSSE3,
+                detail::decodeFloatsToBytesDenseSSSE3};
+    case SimdLevel::AVX2:
+        return {l,
+                detail::encodeBytesToFloatsAVX2,
+                detail::decodeFloatsToBytesAVX2,
+                detail::validateFloatsAVX2,
+                detail::findFloatInRangeAVX2,
+                detail::encodeBytesToFloatsDenseAVX2,
+                detail::decodeFloatsToBytesDenseAVX2};
+    case SimdLevel::AVX512_VBMI:
+        return {l,
+                detail::encodeBytesToFloatsAVX512VBMI,
+                detail::decodeFloatsToBytesAVX512VBMI,
+                detail::validateFloatsAVX512VBMI,
+                detail::findFloatInRangeAVX512VBMI,
+                detail::encodeBytesToFloatsDenseAVX2,
+                detail::decodeFloatsToBytesDenseAVX2};
+#endif
+    default:
+        break;
+    }
+    return {SimdLevel::SCALAR,
+            detail::encodeBytesToFloatsScalar,
+            detail::decodeFloatsToBytesScalar,
+            detail::validateFloatsScalar,
+            detail::findFloatInRangeScalar,
+            detail::encodeBytesToFloatsDenseScalar,
+            detail::decodeFloatsToBytesDenseScalar};
+}
+
+inline const KernelTable &activeKernels() noexcept
+{
+    static const KernelTable table = kernelsForLevel(selectSimdLevel());
+    return table;
+}
+
+inline size_t encodeBytesToFloats(const uint8_t *in, size_t nBytes, float *out) noexcept
+{
+    return activeKernels().encodeBytesToFloats(in, nBytes, out);
+}
+
+// Writes exactly 3 * nFloats bytes to out
+inline void decodeFloatsToBytes(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    activeKernels().decodeFloatsToBytes(in, nFloats, out);
+}
+
+// Returns the number of floats written, 2 * ceil(nBytes / 7)
+inline size_t encodeBytesToFloatsDense(const uint8_t *in, size_t nBytes, float *out) noexcept
+{
+    return activeKernels().encodeBytesToFloatsDense(in, nBytes, out);
+}
+
+// nFloats must be even; writes exactly 7 * nFloats / 2 bytes to out
+inline void decodeFloatsToBytesDense(const float *in, size_t nFloats, uint8_t *out) noexcept
+{
+    activeKernels().decodeFloatsToBytesDense(in, nFloats, out);
+}
+
+/*
+ * Strided and indexed variants, for reading and writing interleaved host buffers (port
+ * voltage arrays and the like) without first copying into a contiguous float block. Float
+ * k of the encoding lives at out[k * stride], or out[index[k]] for the index list versions,
+ * and similarly for the decode inputs. They run the dispatched kernels a chunk at a time
+ * through a small stack buffer which stays in L1, so they cost little over the contiguous
+ * versions.
+ */
+static constexpr size_t kStridedChunkFloats{64};
+
+inline size_t encodeBytesToFloatsStrided(const uint8_t *in, size_t nBytes, float *out,
+                                         size_t outStride) noexcept
+{
+    float chunk[kStridedChunkFloats];
+    size_t o{0};
+    for (size_t i = 0; i < nBytes; i += kStridedChunkFloats * 3)
+    {
+        auto n = nBytes - i < kStridedChunkFloats * 3 ? nBytes - i : kStridedChunkFloats * 3;
+        auto c = encodeBytesToFloats(in + i, n, chunk);
+        for (size_t k = 0; k < c; ++k)
+            out[(o + k) * outStride] = chunk[k];
+        o += c;
+    }
+    return o;
+}
+
+inline size_t encodeBytesToFloatsIndexed(const uint8_t *in, size_t nBytes, float *out,
+                                         const uint32_t *outIndex) noexcept
+{
+    float chunk[kStridedChunkFloats];
+    size_t o{0};
+    for (size_t i = 0; i < nBytes; i += kStridedChunkFloats * 3)
+    {
+        auto n = nBytes - i < kStridedChunkFloats * 3 ? nBytes - i : kStridedChunkFloats * 3;
+        auto c = encodeBytesToFloats(in + i, n, chunk);
+        for (size_t k = 0; k < c; ++k)
+            out[outIndex[o + k]] = chunk[k];
+        o += c;
+    }
+    return o;
+}
+
+inline void decodeFloatsToBytesStrided(const float *in, size_t inStride, size_t nFloats,
+                                       uint8_t *out) noexcept
+{
+    float chunk[kStridedChunkFloats];
+    for (size_t i = 0; i < nFloats; i += kStridedChunkFloats)
+    {
+        auto n = nFloats - i < kStridedChunkFloats ? nFloats - i : kStridedChunkFloats;
+        for (size_t k = 0; k < n; ++k)
+            chunk[k] = in[(i + k) * inStride];
+        decodeFloatsToBytes(chunk, n, out + 3 * i);
+    }
+}
+
+inline void decodeFloatsToBytesIndexed(const float *in, const uint32_t *inIndex, size_t nFloats,
+                                       uint8_t *out) noexcept
+{
+    float chunk[kStridedChunkFloats];
+    for (size_t i = 0; i < nFloats; i += kStridedChunkFloats)
+    {
+        auto n = nFloats - i < kStridedChunkFloats ? nFloats - i : kStridedChunkFloats;
+        for (size_t k = 0; k < n; ++k)
+            chunk[k] = in[inIndex[i + k]];
+        decodeFloatsToBytes(chunk, n, out + 3 * i);
+    }
+}
+
 } // namespace tipsy
 #endif // TIPSY_ENCODER_BINARY_TO_FLOAT_H
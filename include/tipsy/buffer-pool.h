@@ -0,0 +1,142 @@
+#pragma once
+#ifndef TIPSY_ENCODER_BUFFER_POOL_H
+#define TIPSY_ENCODER_BUFFER_POOL_H
+/*
+ * A fixed set of decode buffers in a few size classes, all allocated when the pool is
+ * built. Acquiring and releasing never allocate or lock: each class keeps a bitmap of the
+ * buffers in use and a buffer is claimed with a compare and swap on its word. So any
+ * number of decoders on the audio thread can take buffers sized to the message in hand,
+ * and consumers on other threads can give them back whenever they are done.
+ *
+ * See ProtocolDecoder::provideBufferPool.
+ */
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <initializer_list>
+#include <memory>
+
+namespace tipsy
+{
+struct BufferPool
+{
+    static constexpr size_t kMaxSizeClasses{8};
+
+    struct SizeClass
+    {
+        uint32_t bytes;
+        uint32_t count;
+    };
+
+    /*
+     * classes must be in ascending size order and at most kMaxSizeClasses long; any past
+     * that are ignored. This is the only place the pool allocates.
+     */
+    BufferPool(const SizeClass *classes, size_t nClasses)
+    {
+        nPools = nClasses < kMaxSizeClasses ? nClasses : kMaxSizeClasses;
+        for (size_t c = 0; c < nPools; ++c)
+        {
+            auto &p = pools[c];
+            p.bytes = classes[c].bytes;
+            p.count = classes[c].count;
+            p.words = (p.count + 63) / 64;
+            p.storage.reset(new unsigned char[(size_t)p.bytes * p.count]);
+            p.inUse.reset(new std::atomic<uint64_t>[p.words]);
+            for (uint32_t w = 0; w < p.words; ++w)
+            {
+                // bits past the end are permanently taken so the scan needs no bounds check
+                auto live = p.count - w * 64;
+                p.inUse[w].store(live >= 64 ? 0 : ~(uint64_t)0 << live);
+            }
+        }
+    }
+    BufferPool(std::initializer_list<SizeClass> classes)
+        : BufferPool(classes.begin(), classes.size())
+    {
+    }
+    BufferPool(const BufferPool &) = delete;
+    BufferPool &operator=(const BufferPool &) = delete;
+
+    /*
+     * A free buffer of at least bytes from the smallest class which has one, or nullptr if
+     * none do. If capacity is non null it gets the buffer's actual size.
+     */
+    unsigned char *acquire(uint32_t bytes, uint32_t *capacity = nullptr)
+    {
+        for (size_t c = 0; c < nPools; ++c)
+        {
+            auto &p = pools[c];
+            if (p.bytes < bytes)
+                continue;
+            for (uint32_t w = 0; w < p.words; ++w)
+            {
+                auto cur = p.inUse[w].load(std::memory_order_relaxed);
+                while (~cur)
+                {
+                    auto bit = ~cur & (cur + 1);
+                    if (p.inUse[w].compare_exchange_weak(cur, cur | bit,
+                                                         std::memory_order_acquire,
+                                                         std::memory_order_relaxed))
+                    {
+                        if (capacity)
+                            *capacity = p.bytes;
+                        return p.storage.get() + (size_t)p.bytes * (w * 64 + bitIndex(bit));
+                    }
+                }
+            }
+        }
+        return nullptr;
+    }
+
+    // Give back a buffer from acquire. Anything else, including nullptr, is ignored.
+    void release(unsigned char *buffer)
+    {
+        for (size_t c = 0; c < nPools; ++c)
+        {
+            auto &p = pools[c];
+            auto *base = p.storage.get();
+            if (buffer < base || buffer >= base + (size_t)p.bytes * p.count)
+                continue;
+            auto i = (size_t)(buffer - base) / p.bytes;
+            p.inUse[i / 64].fetch_and(~((uint64_t)1 << (i % 64)), std::memory_order_release);
+            return;
+        }
+    }
+
+    // Buffers free in class c. A snapshot if other threads are using the pool.
+    uint32_t available(size_t c) const
+    {
+        if (c >= nPools)
+            return 0;
+        uint32_t n{0};
+        for (uint32_t w = 0; w < pools[c].words; ++w)
+        {
+            auto free = ~pools[c].inUse[w].load(std::memory_order_relaxed);
+            for (; free; free &= free - 1)
+                n++;
+        }
+        return n;
+    }
+
+  private:
+    static uint32_t bitIndex(uint64_t bit)
+    {
+        uint32_t i{0};
+        while (bit >>= 1)
+            i++;
+        return i;
+    }
+
+    struct Pool
+    {
+        uint32_t bytes{0}, count{0}, words{0};
+        std::unique_ptr<unsigned char[]> storage;
+        std::unique_ptr<std::atomic<uint64_t>[]> inUse;
+    } pools[kMaxSizeClasses];
+    size_t nPools{0};
+};
+} // namespace tipsy
+
+#endif // TIPSY_ENCODER_BUFFER_POOL_H
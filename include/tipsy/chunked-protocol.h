@@ -0,0 +1,235 @@
+#pragma once
+#ifndef TIPSY_ENCODER_CHUNKED_PROTOCOL_H
+#define TIPSY_ENCODER_CHUNKED_PROTOCOL_H
+/*
+ * A single message body is limited to kMaxMessageLength by its 24 bit size field. To send
+ * something bigger, say a whole sample library, the chunked encoder splits it into a run of
+ * continuation frames (see kContinuationFrameFlag) sent back to back, and the chunked
+ * decoder checks they arrive in sequence while the underlying ProtocolDecoder writes each
+ * one straight to its place in the caller's buffer.
+ *
+ * The chunked decoder passes ordinary messages through untouched, so one decoder can sit
+ * on a cable which carries both.
+ */
+
+#include "protocol.h"
+
+namespace tipsy
+{
+struct ChunkedProtocolEncoder
+{
+    // The body bytes per frame. Can only be changed between messages.
+    bool setChunkSize(uint32_t b)
+    {
+        if (b == 0 || b > kMaxMessageLength || !isDormant())
+            return false;
+        chunkSize = b;
+        return true;
+    }
+    uint32_t getChunkSize() const { return chunkSize; }
+
+    bool setEncodingVersion(uint16_t v) { return encoder.setEncodingVersion(v); }
+
+    /*
+     * Start sending inDataBytes from inData as continuation frames. The data must stay valid
+     * until the message completes; the mime type is copied.
+     */
+    TIPSY_NODISCARD
+    EncoderResult initiateMessage(const char *inMimeType, uint64_t inDataBytes,
+                                  const unsigned char *const inData)
+    {
+        if (inDataBytes > kMaxChunkedMessageLength ||
+            (inDataBytes + chunkSize - 1) / chunkSize > kMaxContinuationFrames)
+        {
+            return EncoderResult::ERROR_MESSAGE_TOO_LARGE;
+        }
+        auto check = ProtocolEncoder::checkMessage(inMimeType, 0, nullptr);
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        if ((inDataBytes > 0) && (nullptr == inData))
+        {
+            return EncoderResult::ERROR_MISSING_DATA;
+        }
+        if (!isDormant())
+        {
+            return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
+        }
+
+        strcpy(mimeType, inMimeType);
+        data = inData;
+        totalBytes = inDataBytes;
+        sentBytes = 0;
+        sequence = 0;
+        startFrame();
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    /*
+     * As ProtocolEncoder::getNextMessageFloat, except that MESSAGE_COMPLETE only comes at the
+     * end of the last frame; the next frame starts straight after each earlier one.
+     */
+    TIPSY_NODISCARD
+    EncoderResult getNextMessageFloat(float &f)
+    {
+        auto r = encoder.getNextMessageFloat(f);
+        if (r == EncoderResult::MESSAGE_COMPLETE && sentBytes < totalBytes)
+        {
+            startFrame();
+            return EncoderResult::ENCODING_MESSAGE;
+        }
+        return r;
+    }
+
+    // As ProtocolEncoder::getNextMessageFloats, running on across frame boundaries
+    size_t getNextMessageFloats(float *out, size_t n)
+    {
+        size_t w{0};
+        while (w < n)
+        {
+            w += encoder.getNextMessageFloats(out + w, n - w);
+            if (!encoder.isDormant())
+                continue;
+            if (sentBytes == totalBytes)
+                break;
+            startFrame();
+        }
+        return w;
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult terminateCurrentMessage()
+    {
+        sentBytes = totalBytes;
+        return encoder.terminateCurrentMessage();
+    }
+
+    bool isDormant() { return encoder.isDormant() && sentBytes == totalBytes; }
+    bool isError(EncoderResult r) const { return encoder.isError(r); }
+
+  private:
+    void startFrame()
+    {
+        auto remaining = totalBytes - sentBytes;
+        auto n = (uint32_t)(remaining < chunkSize ? remaining : chunkSize);
+        ContinuationFrame frame{sequence++, sentBytes, totalBytes};
+        // initiateMessage checked everything initiateContinuationFrame can refuse
+        auto r = encoder.initiateContinuationFrame(mimeType, n, data + sentBytes, frame);
+        assert(r == EncoderResult::MESSAGE_INITIATED);
+        (void)r;
+        sentBytes += n;
+    }
+
+    ProtocolEncoder encoder;
+    uint32_t chunkSize{kMaxMessageLength};
+
+    char mimeType[kMaxMimeTypeSize];
+    const unsigned char *data{nullptr};
+    uint64_t totalBytes{0}, sentBytes{0};
+    uint32_t sequence{0};
+};
+
+struct ChunkedProtocolDecoder
+{
+    // As ProtocolDecoder, the buffer must be larger than the whole message
+    bool provideDataBuffer(unsigned char *data, uint32_t size)
+    {
+        if (!decoder.provideDataBuffer(data, size))
+            return false;
+        bufferSize = size;
+        return true;
+    }
+    // As ProtocolDecoder::provideMimeTypeBuffer
+    bool provideMimeTypeBuffer(char *buffer) { return decoder.provideMimeTypeBuffer(buffer); }
+
+    /*
+     * As ProtocolDecoder::readFloat. For a chunked message HEADER_READY comes with the first
+     * frame and BODY_READY with the last; frames in between report PARSING_BODY throughout.
+     * A frame out of order, or one which did not arrive whole, gives
+     * ERROR_CHUNK_OUT_OF_SEQUENCE and drops the partial message.
+     */
+    DecoderResult readFloat(float f)
+    {
+        auto r = decoder.readFloat(f);
+        auto ready = r == DecoderResult::HEADER_READY || r == DecoderResult::BODY_READY;
+        if (decoder.isContinuationFrame())
+        {
+            if (r == DecoderResult::HEADER_READY)
+                r = startFrame();
+            else if (r == DecoderResult::BODY_READY)
+                r = finishFrame();
+        }
+        else if (ready && expectedSequence > 0)
+        {
+            // an ordinary message cutting into a chunked one
+            r = DecoderResult::ERROR_CHUNK_OUT_OF_SEQUENCE;
+        }
+
+        if (ProtocolDecoder::isError(r))
+            expectedSequence = 0;
+        else if (expectedSequence > 0)
+            r = DecoderResult::PARSING_BODY;
+        return r;
+    }
+
+    // As ProtocolDecoder::readBodyFloats; body floats never finish a frame so need no checks
+    size_t readBodyFloats(const float *f, size_t n) { return decoder.readBodyFloats(f, n); }
+
+    const char *getMimeType() const { return decoder.getMimeType(); }
+    // The size of the whole message, chunked or not
+    uint64_t getDataSize() const
+    {
+        return decoder.isContinuationFrame() ? totalBytes : decoder.getDataSize();
+    }
+    // How much of a chunked message has arrived so far
+    uint64_t getReceivedBytes() const { return receivedBytes; }
+    bool isChunked() const { return decoder.isContinuationFrame(); }
+
+    static bool isError(DecoderResult r) { return ProtocolDecoder::isError(r); }
+
+  private:
+    DecoderResult startFrame()
+    {
+        const auto &c = decoder.getContinuationFrame();
+        if (c.sequence == 0)
+        {
+            if (c.offset != 0)
+                return DecoderResult::ERROR_CHUNK_OUT_OF_SEQUENCE;
+            if (c.totalBytes >= bufferSize)
+                return DecoderResult::ERROR_DATA_TOO_LARGE;
+            totalBytes = c.totalBytes;
+            receivedBytes = 0;
+            expectedSequence = 0;
+            return DecoderResult::HEADER_READY;
+        }
+        if (c.sequence != expectedSequence || c.offset != receivedBytes ||
+            c.totalBytes != totalBytes)
+        {
+            return DecoderResult::ERROR_CHUNK_OUT_OF_SEQUENCE;
+        }
+        return DecoderResult::PARSING_BODY;
+    }
+
+    DecoderResult finishFrame()
+    {
+        // a frame cut short or failed part way still ends on BODY_READY; counting its bytes
+        // would pass a message with a hole in it
+        if (!decoder.isMessageComplete())
+            return DecoderResult::ERROR_CHUNK_OUT_OF_SEQUENCE;
+        receivedBytes += decoder.getDataSize();
+        expectedSequence++;
+        if (receivedBytes < totalBytes)
+            return DecoderResult::PARSING_BODY;
+        expectedSequence = 0;
+        return DecoderResult::BODY_READY;
+    }
+
+    ProtocolDecoder decoder;
+    uint32_t bufferSize{0};
+    uint64_t totalBytes{0}, receivedBytes{0};
+    uint32_t expectedSequence{0};
+};
+} // namespace tipsy
+
+#endif // TIPSY_ENCODER_CHUNKED_PROTOCOL_H
@@ -0,0 +1,196 @@
+#pragma once
+#ifndef TIPSY_ENCODER_HANDOFF_PROTOCOL_H
+#define TIPSY_ENCODER_HANDOFF_PROTOCOL_H
+/*
+ * A ProtocolDecoder which rotates through N data buffers and hands each finished message
+ * to a consumer thread through a single producer / single consumer queue. The audio thread
+ * reads floats as usual; at BODY_READY the message (mime type, size and a pointer to its
+ * buffer) is published and decoding moves straight on to the next buffer, so nothing has
+ * to be copied or parsed on the audio thread. The consumer looks at front() for as long
+ * as it likes and pop()s it to give the buffer back.
+ *
+ * Buffers go round in order, so with all of them waiting on the consumer the decoder has
+ * nowhere to put the next message and reports ERROR_NO_BUFFER_AVAILABLE for it. Neither
+ * side locks or allocates.
+ */
+
+#include "protocol.h"
+
+#include <atomic>
+
+namespace tipsy
+{
+template <size_t N = 4> struct HandoffProtocolDecoder
+{
+    static_assert(N >= 2 && (N & (N - 1)) == 0, "Buffer count must be a power of two");
+
+    struct DecodedMessage
+    {
+        char mimeType[kMaxMimeTypeSize];
+        uint16_t mimeTypeId;
+        uint16_t version;
+        uint32_t dataSize;
+        const unsigned char *data;
+    };
+
+    /*
+     * Audio side, before any traffic. storage holds N buffers of bufferSize bytes each and
+     * must outlive the decoder.
+     */
+    bool provideDataBuffers(unsigned char *storage, uint32_t inBufferSize)
+    {
+        if (tail.load(std::memory_order_relaxed) != head.load(std::memory_order_acquire))
+            return false;
+        buffers = storage;
+        bufferSize = inBufferSize;
+        starved = !decoder.provideDataBuffer(bufferFor(tail.load(std::memory_order_relaxed)),
+                                             bufferSize);
+        return !starved;
+    }
+
+    // Audio side. See ProtocolDecoder::provideMimeTypeBuffer.
+    bool provideMimeTypeBuffer(char *buffer) { return decoder.provideMimeTypeBuffer(buffer); }
+
+    // Audio side. See ProtocolDecoder::provideMimeTypeTable.
+    bool provideMimeTypeTable(char *table, uint16_t entries)
+    {
+        return decoder.provideMimeTypeTable(table, entries);
+    }
+
+    // Audio side. See ProtocolDecoder::resync.
+    void resync() { decoder.resync(); }
+    void setResyncOnError(bool r) { decoder.setResyncOnError(r); }
+    bool isResyncing() const { return decoder.isResyncing(); }
+    uint32_t getDiscardedFloats() const { return decoder.getDiscardedFloats(); }
+
+    // Audio side. As ProtocolDecoder::readFloat, publishing each message at BODY_READY.
+    TIPSY_NODISCARD
+    DecoderResult readFloat(float f)
+    {
+        auto r = decoder.readFloat(f);
+        // a buffer freed mid message has to wait for the next one to start
+        if (starved && (f == kMessageBeginSentinel || f == kSizeSentinel))
+            claimBuffer();
+        return handle(r);
+    }
+
+    // Audio side. As ProtocolDecoder::readFloats.
+    size_t readFloats(const float *f, size_t n, DecoderEvent *events, size_t maxEvents)
+    {
+        assert(maxEvents > 0);
+        size_t i{0}, e{0};
+        while (i < n && e < maxEvents)
+        {
+            if (starved)
+            {
+                auto r = readFloat(f[i]);
+                if (r == DecoderResult::HEADER_READY || r == DecoderResult::BODY_READY ||
+                    r == DecoderResult::RESYNCED || isError(r))
+                {
+                    events[e++] = {r, (uint32_t)i};
+                    if (r == DecoderResult::BODY_READY)
+                        break;
+                }
+                i++;
+                continue;
+            }
+            // the decoder stops at BODY_READY, so the buffer turns over before the next message
+            auto c = decoder.readFloats(f + i, n - i, events + e, maxEvents - e);
+            for (size_t k = e; k < e + c; ++k)
+            {
+                events[k].result = handle(events[k].result);
+                events[k].offset += (uint32_t)i;
+            }
+            e += c;
+            break;
+        }
+        return e;
+    }
+
+    // Consumer side. The oldest message not yet popped, or nullptr if there is none.
+    const DecodedMessage *front() const
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+            return nullptr;
+        return &ring[h & (N - 1)];
+    }
+
+    // Consumer side. Done with front(); its buffer goes back to the decoder.
+    void pop()
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h != tail.load(std::memory_order_acquire))
+            head.store(h + 1, std::memory_order_release);
+    }
+
+    // Messages waiting for the consumer. Exact on the consumer thread, a snapshot elsewhere.
+    size_t pending() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    static bool isError(DecoderResult r) { return ProtocolDecoder::isError(r); }
+
+  private:
+    unsigned char *bufferFor(size_t slot) { return buffers + (slot & (N - 1)) * bufferSize; }
+
+    DecoderResult handle(DecoderResult r)
+    {
+        if (r == DecoderResult::BODY_READY && !starved && decoder.isMessageComplete() &&
+            !decoder.isUrgentMessage())
+        {
+            publish();
+        }
+        else if (starved && r == DecoderResult::ERROR_DATA_TOO_LARGE)
+        {
+            r = DecoderResult::ERROR_NO_BUFFER_AVAILABLE;
+        }
+        return r;
+    }
+
+    void publish()
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        auto &m = ring[t & (N - 1)];
+        // the name and its terminator only, not the whole slot
+        auto *mt = decoder.getMimeType();
+        auto len = strlen(mt);
+        if (len > kMaxMimeTypeSize - 1)
+            len = kMaxMimeTypeSize - 1;
+        memcpy(m.mimeType, mt, len);
+        m.mimeType[len] = 0;
+        m.mimeTypeId = decoder.getMimeTypeId();
+        m.version = decoder.getVersion();
+        m.dataSize = decoder.getDataSize();
+        m.data = bufferFor(t);
+        tail.store(t + 1, std::memory_order_release);
+        claimBuffer();
+    }
+
+    // The buffer after the last published one is free once the consumer has popped it
+    void claimBuffer()
+    {
+        auto t = tail.load(std::memory_order_relaxed);
+        starved = t - head.load(std::memory_order_acquire) == N;
+        if (!starved)
+            starved = !decoder.provideDataBuffer(bufferFor(t), bufferSize);
+        else
+            decoder.provideDataBuffer(nullptr, 0);
+    }
+
+    ProtocolDecoder decoder;
+    unsigned char *buffers{nullptr};
+    uint32_t bufferSize{0};
+    bool starved{true};
+
+    DecodedMessage ring[N];
+    // head is only written by the consumer and tail only by the audio thread. Where
+    // TIPSY_CACHE_LINE_ALIGNED applies each starts a cache line of its own, which nothing
+    // else in the decoder shares.
+    TIPSY_CACHE_LINE_ALIGNED std::atomic<size_t> head{0};
+    TIPSY_CACHE_LINE_ALIGNED std::atomic<size_t> tail{0};
+};
+} // namespace tipsy
+
+#endif // TIPSY_ENCODER_HANDOFF_PROTOCOL_H
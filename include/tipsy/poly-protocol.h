@@ -0,0 +1,149 @@
+#pragma once
+#ifndef TIPSY_ENCODER_POLY_PROTOCOL_H
+#define TIPSY_ENCODER_POLY_PROTOCOL_H
+/*
+ * A polyphonic cable carries up to 16 floats per sample, so rather than leave 15 of them
+ * idle we can stripe a single message stream across the lanes. The stream is exactly the
+ * one ProtocolEncoder produces; at each sample lane c carries stream float (sample * lanes + c).
+ * A message always starts on lane 0, and once it is complete the remaining lanes of that
+ * sample are dormant (0).
+ *
+ * The decoder reads the lanes back in order through a regular ProtocolDecoder, so the only
+ * thing the two ends have to agree on is the lane count, which is just the channel count
+ * of the cable.
+ */
+
+#include "protocol.h"
+
+namespace tipsy
+{
+static constexpr int kMaxPolyLanes{16};
+
+struct PolyProtocolEncoder
+{
+    // Can only be changed between messages. Returns false if lanes is out of range or a
+    // message is active.
+    bool setLanes(int l)
+    {
+        if (l < 1 || l > kMaxPolyLanes || !encoder.isDormant())
+            return false;
+        lanes = l;
+        return true;
+    }
+    int getLanes() const { return lanes; }
+
+    bool setEncodingVersion(uint16_t v) { return encoder.setEncodingVersion(v); }
+
+    TIPSY_NODISCARD
+    EncoderResult initiateMessage(const char *inMimeType, uint32_t inDataBytes,
+                                  const unsigned char *const inData)
+    {
+        return encoder.initiateMessage(inMimeType, inDataBytes, inData);
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult initiateMessage(const char *inMimeType, const DataSegment *inSegments,
+                                  size_t nSegments)
+    {
+        return encoder.initiateMessage(inMimeType, inSegments, nSegments);
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult initiateStreamingMessage(const char *inMimeType, uint32_t inDataBytes,
+                                           ProtocolEncoder::BodyProducer inProducer,
+                                           void *inProducerData)
+    {
+        return encoder.initiateStreamingMessage(inMimeType, inDataBytes, inProducer,
+                                                inProducerData);
+    }
+
+    /*
+     * Fill out[0 .. getLanes() - 1] with the next sample. Returns MESSAGE_COMPLETE if the
+     * message finished in this sample, DORMANT if there is no message and ENCODING_MESSAGE
+     * otherwise.
+     */
+    TIPSY_NODISCARD
+    EncoderResult getNextMessageSample(float *out)
+    {
+        if (encoder.isDormant())
+        {
+            memset(out, 0, lanes * sizeof(float));
+            return EncoderResult::DORMANT;
+        }
+
+        auto w = encoder.getNextMessageFloats(out, lanes);
+        for (auto c = w; c < (size_t)lanes; ++c)
+            out[c] = 0;
+        return encoder.isDormant() ? EncoderResult::MESSAGE_COMPLETE
+                                   : EncoderResult::ENCODING_MESSAGE;
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult terminateCurrentMessage() { return encoder.terminateCurrentMessage(); }
+
+    bool isDormant() { return encoder.isDormant(); }
+    bool isError(EncoderResult r) const { return encoder.isError(r); }
+
+  private:
+    ProtocolEncoder encoder;
+    int lanes{kMaxPolyLanes};
+};
+
+struct PolyProtocolDecoder
+{
+    bool provideDataBuffer(unsigned char *data, uint32_t size)
+    {
+        return decoder.provideDataBuffer(data, size);
+    }
+    // See ProtocolDecoder::provideMimeTypeBuffer
+    bool provideMimeTypeBuffer(char *buffer) { return decoder.provideMimeTypeBuffer(buffer); }
+
+    const char *getMimeType() const { return decoder.getMimeType(); }
+    uint32_t getDataSize() const { return decoder.getDataSize(); }
+
+    static bool isError(DecoderResult r) { return ProtocolDecoder::isError(r); }
+
+    /*
+     * Read one sample of nLanes floats. Since several decoder transitions can happen in a
+     * single sample this returns the most significant one: the first error if there is one,
+     * then BODY_READY, HEADER_READY, PARSING_BODY, PARSING_HEADER and finally DORMANT. The
+     * mime type is still available when BODY_READY is returned, even if the header arrived
+     * in the same sample.
+     */
+    TIPSY_NODISCARD
+    DecoderResult readSample(const float *in, int nLanes)
+    {
+        auto res = DecoderResult::DORMANT;
+        for (int c = 0; c < nLanes; ++c)
+        {
+            auto r = decoder.readFloat(in[c]);
+            if (isError(res))
+                continue;
+            if (isError(r) || rank(r) > rank(res))
+                res = r;
+        }
+        return res;
+    }
+
+  private:
+    ProtocolDecoder decoder;
+
+    static int rank(DecoderResult r)
+    {
+        switch (r)
+        {
+        case DecoderResult::BODY_READY:
+            return 4;
+        case DecoderResult::HEADER_READY:
+            return 3;
+        case DecoderResult::PARSING_BODY:
+            return 2;
+        case DecoderResult::PARSING_HEADER:
+            return 1;
+        default:
+            return 0;
+        }
+    }
+};
+} // namespace tipsy
+#endif // TIPSY_ENCODER_POLY_PROTOCOL_H
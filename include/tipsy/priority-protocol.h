@@ -0,0 +1,114 @@
+#pragma once
+#ifndef TIPSY_ENCODER_PRIORITY_PROTOCOL_H
+#define TIPSY_ENCODER_PRIORITY_PROTOCOL_H
+/*
+ * Two messages in flight on one cable: a bulk message, which may be megabytes long, and an
+ * urgent one (transport, clock and the like) which cuts into the bulk body as soon as it is
+ * initiated rather than waiting for it to finish. The bulk body then resumes at the same
+ * offset. An urgent message waits at most for the bulk header to go out, so its latency is
+ * bounded by a header and its own length whatever the bulk size.
+ *
+ * The decoding end is a regular ProtocolDecoder with an urgent buffer provided; see
+ * kPreemptFlag.
+ */
+
+#include "protocol.h"
+
+namespace tipsy
+{
+struct PriorityProtocolEncoder
+{
+    PriorityProtocolEncoder() { urgent.setPreempting(true); }
+
+    bool setEncodingVersion(uint16_t v)
+    {
+        if (!isDormant())
+            return false;
+        return bulk.setEncodingVersion(v) && urgent.setEncodingVersion(v);
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult initiateMessage(const char *inMimeType, uint32_t inDataBytes,
+                                  const unsigned char *const inData)
+    {
+        return bulk.initiateMessage(inMimeType, inDataBytes, inData);
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult initiateMessage(const char *inMimeType, const DataSegment *inSegments,
+                                  size_t nSegments)
+    {
+        return bulk.initiateMessage(inMimeType, inSegments, nSegments);
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult initiateStreamingMessage(const char *inMimeType, uint32_t inDataBytes,
+                                           ProtocolEncoder::BodyProducer inProducer,
+                                           void *inProducerData)
+    {
+        return bulk.initiateStreamingMessage(inMimeType, inDataBytes, inProducer,
+                                             inProducerData);
+    }
+
+    // Send this ahead of the rest of the bulk message. One urgent message at a time.
+    TIPSY_NODISCARD
+    EncoderResult initiateUrgentMessage(const char *inMimeType, uint32_t inDataBytes,
+                                        const unsigned char *const inData)
+    {
+        return urgent.initiateMessage(inMimeType, inDataBytes, inData);
+    }
+
+    /*
+     * As ProtocolEncoder::getNextMessageFloat. MESSAGE_COMPLETE comes at the end of either
+     * message; isBulkDormant and isUrgentDormant tell them apart.
+     */
+    TIPSY_NODISCARD
+    EncoderResult getNextMessageFloat(float &f)
+    {
+        if (urgentReady())
+            return urgent.getNextMessageFloat(f);
+        return bulk.getNextMessageFloat(f);
+    }
+
+    /*
+     * As ProtocolEncoder::getNextMessageFloats, carrying on from one message to the other.
+     * While an urgent message waits on the bulk header the header goes a float at a time so
+     * the urgent one starts the moment it can.
+     */
+    size_t getNextMessageFloats(float *out, size_t n)
+    {
+        size_t w{0};
+        while (w < n && !isDormant())
+        {
+            if (urgentReady())
+                w += urgent.getNextMessageFloats(out + w, n - w);
+            else if (!urgent.isDormant())
+                (void)bulk.getNextMessageFloat(out[w++]);
+            else
+                w += bulk.getNextMessageFloats(out + w, n - w);
+        }
+        return w;
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult terminateBulkMessage() { return bulk.terminateCurrentMessage(); }
+    TIPSY_NODISCARD
+    EncoderResult terminateUrgentMessage() { return urgent.terminateCurrentMessage(); }
+
+    bool isBulkDormant() { return bulk.isDormant(); }
+    bool isUrgentDormant() { return urgent.isDormant(); }
+    bool isDormant() { return bulk.isDormant() && urgent.isDormant(); }
+    bool isError(EncoderResult r) const { return bulk.isError(r); }
+
+  private:
+    // The bulk header has to go out whole, but anywhere in its body will do
+    bool urgentReady()
+    {
+        return !urgent.isDormant() && (bulk.isDormant() || bulk.isPreemptible());
+    }
+
+    ProtocolEncoder bulk, urgent;
+};
+} // namespace tipsy
+
+#endif // TIPSY_ENCODER_PRIORITY_PROTOCOL_H
@@ -10,9 +10,16 @@
  * functions to make sure you get the ownership correct.
  */
 
+#include <cassert>
+#include <cstddef>
 #include <cstdint>
 #include <cstring>
+#include <string>
+#if __cplusplus >= 201703L
+#include <array>
+#endif
 #include "binary-to-float.h"
+#include "buffer-pool.h"
 #include "version.h"
 
 #if __cplusplus >= 201703L
@@ -21,12 +28,19 @@
 #define TIPSY_NODISCARD
 #endif
 
+// Cache line alignment, only where new honours it
+#if defined(__cpp_aligned_new)
+#define TIPSY_CACHE_LINE_ALIGNED alignas(64)
+#else
+#define TIPSY_CACHE_LINE_ALIGNED
+#endif
+
 namespace tipsy
 {
 
 // We know that our 3-byte-to-binary encoder encodes numbers strictly in the range
-// -1,1 so any valid float outside that range can be used as a sentinel. We use floats
-// in the '3' range here.
+// -1,1 (and the dense encoding in -2,2) so any valid float outside that range can be used
+// as a sentinel. We use floats in the '3' range here.
 static constexpr float kMessageBeginSentinel{3.1f};
 static constexpr float kVersionSentinel{3.2f};
 static constexpr float kSizeSentinel{3.3f};
@@ -34,21 +48,145 @@ static constexpr float kMimeTypeSentinel{3.4f};
 static constexpr float kBodySentinel{3.5f};
 static constexpr float kEndMessageSentinel{3.6f};
 
-static constexpr uint16_t kVersion{0x01};
+/*
+ * The version header says how the body is encoded. Version 1 bodies carry 3 bytes per float
+ * (FloatBytes) and version 2 bodies 7 bytes per pair of floats (the dense encoding in
+ * binary-to-float.h). Headers are always in the version 1 format, so a decoder which
+ * only knows version 1 will cleanly reject a version 2 message. kVersion is the highest
+ * version we can decode; encoders send version 1 unless asked otherwise.
+ */
+static constexpr uint16_t kVersion24Bit{0x01};
+static constexpr uint16_t kVersion28Bit{0x02};
+static constexpr uint16_t kVersion{kVersion28Bit};
+
+/*
+ * A message too large for one 24 bit size field goes as a run of continuation frames, each
+ * an ordinary message whose version carries this flag. The version value is then followed
+ * by five more floats: the frame's sequence number and the 48 bit byte offset of its body
+ * and total size of the whole message, each as low then high 24 bits. Decoders which
+ * predate continuation frames see an unknown version and cleanly reject them.
+ */
+static constexpr uint16_t kContinuationFrameFlag{0x80};
+static constexpr uint32_t kContinuationFields{5};
+
+/*
+ * A session opens with an ordinary message whose version carries this flag. Until the next
+ * full header, each further message on the cable is just kSizeSentinel, its size, the body
+ * and kEndMessageSentinel, reusing the version and mime type of the opening message. Older
+ * decoders reject both the flag and the short header.
+ */
+static constexpr uint16_t kSessionFlag{0x40};
+
+/*
+ * An interned mime type is sent once in full and then referred to by a 16 bit ID. A version
+ * with this flag has one extra float at the start of its mime section: the ID, with bit 16
+ * set if the usual size and characters follow to announce it, or clear if the decoder
+ * should look the ID up in its table and nothing else follows.
+ */
+static constexpr uint16_t kMimeTypeIdFlag{0x20};
+static constexpr uint32_t kMimeTypeAnnounceBit{1 << 16};
+static constexpr uint16_t kNoMimeTypeId{0xFFFF};
+
+/*
+ * An urgent message may be sent in the middle of another message's body, which then carries
+ * on where it left off once the urgent message ends. Its version carries this flag, which
+ * tells the decoder to set the interrupted body aside rather than abandon it, and to put
+ * the urgent body in its separate urgent buffer. Only one message can be set aside at a time.
+ */
+static constexpr uint16_t kPreemptFlag{0x10};
+
+/*
+ * A streaming body (see ProtocolEncoder::initiateStreamingMessage) may stall, sending 0 in
+ * place of body floats while its producer catches up. Its version carries this flag so that
+ * decoders which predate streaming reject the message as an unknown version rather than
+ * store the 0s as data.
+ */
+static constexpr uint16_t kStreamingFlag{0x08};
+
+/*
+ * The sending side of an interned mime type. The first message sent with it announces
+ * the mime type and sets announced; later ones carry just the ID. Clear announced to send it
+ * in full again, for instance when the far end may have restarted.
+ */
+struct InternedMimeType
+{
+    const char *mimeType;
+    uint16_t id;
+    bool announced;
+};
+
+struct ContinuationFrame
+{
+    uint32_t sequence;
+    uint64_t offset;
+    uint64_t totalBytes;
+};
 
 // limits
 static constexpr size_t kMaxMimeTypeSize{256};
+// what a decoder holds of a sent mime type without a mime type buffer
+static constexpr size_t kInlineMimeTypeSize{32};
 static constexpr size_t kMaxMessageLength{1 << 23};
+static constexpr uint64_t kMaxChunkedMessageLength{((uint64_t)1 << 48) - 1};
+static constexpr uint32_t kMaxContinuationFrames{1 << 24};
+
+static constexpr float kAllSentinels[]{kMessageBeginSentinel, kVersionSentinel,
+                                       kSizeSentinel,         kMimeTypeSentinel,
+                                       kBodySentinel,         kEndMessageSentinel};
+static constexpr size_t kNumSentinels{sizeof(kAllSentinels) / sizeof(kAllSentinels[0])};
+
+// Every sentinel lies in this range, so anything outside it is cheaply known not to be one
+static constexpr float kLowestSentinel{kMessageBeginSentinel};
+static constexpr float kHighestSentinel{kEndMessageSentinel};
 
 inline bool isValidSentinel(float f) noexcept
 {
-    return (f == kMessageBeginSentinel) || (f == kVersionSentinel) || (f == kSizeSentinel) ||
-           (f == kMimeTypeSentinel) || (f == kBodySentinel) || (f == kEndMessageSentinel);
+    // non short circuit so this compiles to compares and ors rather than branches
+    return (f == kMessageBeginSentinel) | (f == kVersionSentinel) | (f == kSizeSentinel) |
+           (f == kMimeTypeSentinel) | (f == kBodySentinel) | (f == kEndMessageSentinel);
 }
-inline bool isValidProtocolEncoding(float f) noexcept
+inline bool isValidProtocolEncoding(float f, uint16_t version = kVersion24Bit) noexcept
 {
+    // 0 is an idle cable or a stalled streaming body, and version 1 data already allows it
+    if (version == kVersion28Bit)
+        return f == 0.f || isValidDenseDataEncoding(f) || isValidSentinel(f);
     return isValidDataEncoding(f) || isValidSentinel(f);
 }
+
+/*
+ * Check an entire block of floats, for instance a cable buffer, before handing it to the
+ * decoder. Returns the index of the first float for which isValidProtocolEncoding(f, version)
+ * is false, or n if the block is clean. If sentinelMask is non null it must hold
+ * (n + 63) / 64 words; bit i % 64 of word i / 64 is set if f[i] is a sentinel and comes
+ * before the first invalid float, and all other bits are cleared.
+ */
+inline size_t validateProtocolStream(const float *f, size_t n, uint64_t *sentinelMask = nullptr,
+                                     uint16_t version = kVersion24Bit)
+{
+    if (sentinelMask)
+        memset(sentinelMask, 0, ((n + 63) / 64) * sizeof(uint64_t));
+    if (version == kVersion28Bit)
+    {
+        // 0 is below the dense range, so accept it as a sentinel and take it back out of
+        // the mask afterwards
+        static_assert(kNumSentinels + 1 <= detail::kMaxValidateSentinels, "Too many sentinels");
+        float accept[kNumSentinels + 1];
+        memcpy(accept, kAllSentinels, sizeof(kAllSentinels));
+        accept[kNumSentinels] = 0.f;
+        auto r = activeKernels().validateFloats(f, n, DENSE_MINIMUM_MAGNITUDE,
+                                                DENSE_MAXIMUM_MAGNITUDE, accept,
+                                                kNumSentinels + 1, sentinelMask);
+        if (sentinelMask)
+        {
+            for (size_t i = 0; i < r; ++i)
+                if (f[i] == 0.f)
+                    sentinelMask[i / 64] &= ~((uint64_t)1 << (i % 64));
+        }
+        return r;
+    }
+    return activeKernels().validateFloats(f, n, 0.f, maximumEncodedFloat(), kAllSentinels,
+                                          kNumSentinels, sentinelMask);
+}
 inline std::string sentinelDisplayName(float f) noexcept
 {
     if (!isValidSentinel(f))
@@ -67,6 +205,16 @@ inline std::string sentinelDisplayName(float f) noexcept
     return "ERROR";
 }
 
+/*
+ * One piece of a scatter-gather message body. The body is the segments in order, exactly
+ * as if they had been concatenated.
+ */
+struct DataSegment
+{
+    const unsigned char *data;
+    uint32_t size;
+};
+
 struct ProtocolEncoder
 {
     enum class EncoderResult : uint16_t
@@ -76,6 +224,7 @@ struct ProtocolEncoder
         MESSAGE_COMPLETE,
         MESSAGE_TERMINATED,
         MESSAGE_INITIATED,
+        MESSAGE_QUEUED,
 
         ERROR_UNKNOWN = 0x100,
         ERROR_NO_MESSAGE_ACTIVE,
@@ -84,16 +233,112 @@ struct ProtocolEncoder
         ERROR_MESSAGE_ALREADY_ACTIVE,
         ERROR_MISSING_MIME_TYPE,
         ERROR_MISSING_DATA,
+        ERROR_QUEUE_FULL,
+        ERROR_NO_SESSION_ACTIVE,
+        ERROR_INVALID_MIME_TYPE_ID,
     };
 
     bool isError(EncoderResult r) const { return r >= EncoderResult::ERROR_UNKNOWN; }
 
+    /*
+     * The argument checks initiateMessage makes, without touching any encoder state.
+     * Returns MESSAGE_INITIATED if the message could be sent and the error otherwise.
+     */
+    static EncoderResult checkMessage(const char *inMimeType, uint32_t inDataBytes,
+                                      const unsigned char *const inData)
+    {
+        auto check = checkBody(inDataBytes, nullptr == inData);
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        return checkMimeType(inMimeType);
+    }
+
     TIPSY_NODISCARD
     EncoderResult initiateMessage(const char *inMimeType, uint32_t inDataBytes,
                                   const unsigned char *const inData)
     {
         assert(kMessageBeginSentinel > tipsy::maximumEncodedFloat());
 
+        auto check = checkMessage(inMimeType, inDataBytes, inData);
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        if (!isDormant())
+        {
+            return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
+        }
+
+        data = inData;
+        segments = nullptr;
+        producer = nullptr;
+        startMessage(inMimeType, inDataBytes);
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    /*
+     * Send a message whose mime type goes by its ID, announcing it first if need be. Only
+     * inMimeType.announced is changed, so the struct can live wherever suits.
+     */
+    TIPSY_NODISCARD
+    EncoderResult initiateMessage(InternedMimeType &inMimeType, uint32_t inDataBytes,
+                                  const unsigned char *const inData)
+    {
+        auto check = checkMessage(inMimeType.mimeType, inDataBytes, inData);
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        if (inMimeType.id == kNoMimeTypeId)
+        {
+            return EncoderResult::ERROR_INVALID_MIME_TYPE_ID;
+        }
+        if (!isDormant())
+        {
+            return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
+        }
+
+        data = inData;
+        segments = nullptr;
+        producer = nullptr;
+        startMessage(inMimeType.mimeType, inDataBytes, nullptr, false, &inMimeType);
+        inMimeType.announced = true;
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    /*
+     * Open a session with this message. It goes with a full header, and afterwards
+     * initiateSessionMessage sends further bodies with the same mime type and version behind
+     * just a size. Any full header message (initiateMessage and friends) ends the session at
+     * both ends, as does endSession here.
+     */
+    TIPSY_NODISCARD
+    EncoderResult initiateSession(const char *inMimeType, uint32_t inDataBytes,
+                                  const unsigned char *const inData)
+    {
+        auto check = checkMessage(inMimeType, inDataBytes, inData);
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        if (!isDormant())
+        {
+            return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
+        }
+
+        data = inData;
+        segments = nullptr;
+        producer = nullptr;
+        startMessage(inMimeType, inDataBytes, nullptr, true);
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    // Send inData in the open session, with the session's mime type and version
+    TIPSY_NODISCARD
+    EncoderResult initiateSessionMessage(uint32_t inDataBytes, const unsigned char *const inData)
+    {
         if (inDataBytes > kMaxMessageLength)
         {
             return EncoderResult::ERROR_MESSAGE_TOO_LARGE;
@@ -102,28 +347,158 @@ struct ProtocolEncoder
         {
             return EncoderResult::ERROR_MISSING_DATA;
         }
+        if (!isDormant())
+        {
+            return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
+        }
+        if (!inSession)
+        {
+            return EncoderResult::ERROR_NO_SESSION_ACTIVE;
+        }
 
-        if (nullptr == inMimeType)
+        data = inData;
+        segments = nullptr;
+        producer = nullptr;
+        startSessionMessage(inDataBytes);
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    /*
+     * Mark this encoder's messages as urgent (see kPreemptFlag), for sending in the middle of
+     * another encoder's body. PriorityProtocolEncoder does this for you. Only between messages.
+     */
+    bool setPreempting(bool p)
+    {
+        if (!isDormant())
+            return false;
+        preempting = p;
+        return true;
+    }
+    bool isPreempting() const { return preempting; }
+
+    // Whether the header is out, so that an urgent message may be sent before the next float
+    bool isPreemptible() const
+    {
+        return encoderState == EncoderState::BODY || encoderState == EncoderState::END_MESSAGE;
+    }
+
+    // Stop using short headers; the next message goes with a full one
+    void endSession() { inSession = false; }
+    bool isInSession() const { return inSession; }
+
+    /*
+     * Send a body made of nSegments separate pieces without gathering them first. Both the
+     * segment array and the memory it points to must stay valid for the whole message.
+     */
+    TIPSY_NODISCARD
+    EncoderResult initiateMessage(const char *inMimeType, const DataSegment *inSegments,
+                                  size_t nSegments)
+    {
+        // without the segment array there is no size to check either
+        if (nSegments > 0 && nullptr == inSegments)
         {
-            return EncoderResult::ERROR_MISSING_MIME_TYPE;
+            return EncoderResult::ERROR_MISSING_DATA;
         }
-        auto ms = strlen(inMimeType) + 1;
-        if (ms > kMaxMimeTypeSize)
+        uint64_t total{0};
+        bool missing{false};
+        for (size_t i = 0; i < nSegments; ++i)
         {
-            return EncoderResult::ERROR_MIME_TYPE_TOO_LARGE;
+            missing = missing || (inSegments[i].size > 0 && nullptr == inSegments[i].data);
+            total += inSegments[i].size;
+        }
+        auto check = checkBody(total, missing);
+        if (check == EncoderResult::MESSAGE_INITIATED)
+        {
+            check = checkMimeType(inMimeType);
+        }
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        if (!isDormant())
+        {
+            return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
+        }
+
+        data = nullptr;
+        segments = inSegments;
+        segmentIndex = 0;
+        segmentOffset = 0;
+        producer = nullptr;
+        startMessage(inMimeType, (uint32_t)total);
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    /*
+     * Send inData as one frame of a chunked message described by frame. This is the building
+     * block for ChunkedProtocolEncoder, which is what you most likely want.
+     */
+    TIPSY_NODISCARD
+    EncoderResult initiateContinuationFrame(const char *inMimeType, uint32_t inDataBytes,
+                                            const unsigned char *const inData,
+                                            const ContinuationFrame &frame)
+    {
+        auto check = checkMessage(inMimeType, inDataBytes, inData);
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        if (frame.sequence >= kMaxContinuationFrames ||
+            frame.totalBytes > kMaxChunkedMessageLength ||
+            frame.offset + inDataBytes > frame.totalBytes)
+        {
+            return EncoderResult::ERROR_MESSAGE_TOO_LARGE;
         }
         if (!isDormant())
         {
             return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
         }
 
-        mimeType = inMimeType;
-        mimeTypeSize = ms;
         data = inData;
-        dataBytes = inDataBytes;
+        segments = nullptr;
+        producer = nullptr;
+        startMessage(inMimeType, inDataBytes, &frame);
+        return EncoderResult::MESSAGE_INITIATED;
+    }
 
-        setState(EncoderState::START_MESSAGE);
+    /*
+     * Source for a streaming body. Write up to maxBytes of the body to dest and return how
+     * many were written. It is called from getNextMessageFloat(s), so on the audio thread,
+     * and returning 0 because nothing is ready yet is fine.
+     */
+    typedef uint32_t (*BodyProducer)(void *userData, unsigned char *dest, uint32_t maxBytes);
 
+    /*
+     * Send an inDataBytes body which is pulled from producer a block at a time as it goes
+     * out, so it never has to be in memory all at once. While the producer has nothing to
+     * give the encoder sends 0 in place of body floats, which ProtocolDecoder skips. The
+     * version carries kStreamingFlag, so older decoders refuse the message outright.
+     */
+    TIPSY_NODISCARD
+    EncoderResult initiateStreamingMessage(const char *inMimeType, uint32_t inDataBytes,
+                                           BodyProducer inProducer, void *inProducerData)
+    {
+        auto check = checkBody(inDataBytes, nullptr == inProducer);
+        if (check == EncoderResult::MESSAGE_INITIATED)
+        {
+            check = checkMimeType(inMimeType);
+        }
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+        if (!isDormant())
+        {
+            return EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE;
+        }
+
+        data = nullptr;
+        segments = nullptr;
+        producer = inProducer;
+        producerData = inProducerData;
+        streamFill = 0;
+        streamTaken = 0;
+        startMessage(inMimeType, inDataBytes);
         return EncoderResult::MESSAGE_INITIATED;
     }
 
@@ -136,217 +511,942 @@ struct ProtocolEncoder
             f = 0;
             return EncoderResult::DORMANT;
             break;
-        case EncoderState::START_MESSAGE:
+        case EncoderState::HEADER:
         {
-            f = kMessageBeginSentinel;
-            pos++;
-            if (pos == 3)
+            f = header[pos++];
+            if (pos == headerSize)
             {
-                setState(EncoderState::HEADER_VERSION);
+                setState(dataBytes == 0 ? EncoderState::END_MESSAGE : EncoderState::BODY);
             }
             return EncoderResult::ENCODING_MESSAGE;
-            break;
         }
-        case EncoderState::HEADER_VERSION:
+        break;
+        case EncoderState::BODY:
         {
-            if (pos == 0)
+            if (bodyBlockPos == bodyBlockCount)
             {
-                f = kVersionSentinel;
-                pos++;
+                fillBodyBlock();
+                if (bodyBlockCount == 0)
+                {
+                    // a streaming body whose producer has nothing for us yet
+                    f = 0;
+                    return EncoderResult::ENCODING_MESSAGE;
+                }
             }
-            else
+            f = bodyBlock[bodyBlockPos++];
+            if (bodyBlockPos == bodyBlockCount && pos == dataBytes)
             {
-                f = FloatBytes(kVersion);
-                setState(EncoderState::HEADER_SIZE);
+                setState(EncoderState::END_MESSAGE);
             }
             return EncoderResult::ENCODING_MESSAGE;
         }
         break;
-        case EncoderState::HEADER_SIZE:
+        case EncoderState::END_MESSAGE:
         {
-            if (pos == 0)
+            f = kEndMessageSentinel;
+            setState(EncoderState::NO_MESSAGE);
+            return EncoderResult::MESSAGE_COMPLETE;
+        }
+        break;
+        }
+
+        return EncoderResult::ERROR_UNKNOWN;
+    }
+
+    /*
+     * Block version of getNextMessageFloat. Writes up to n floats of the current message to
+     * out and returns how many were written, stopping early only when the message ends (so
+     * the message is complete if isDormant() afterwards) and writing nothing when dormant.
+     * The header is copied from the pre-encoded block and the body is encoded straight
+     * into out with the bulk kernels.
+     */
+    size_t getNextMessageFloats(float *out, size_t n)
+    {
+        size_t w{0};
+        while (w < n && encoderState != EncoderState::NO_MESSAGE)
+        {
+            if (encoderState == EncoderState::HEADER && headerSize - pos > 1)
             {
-                f = kSizeSentinel;
-                pos++;
+                // leave the last header float to the state machine for the transition
+                size_t c = headerSize - pos - 1;
+                c = c < n - w ? c : n - w;
+                memcpy(out + w, header + pos, c * sizeof(float));
+                pos += (uint32_t)c;
+                w += c;
+                continue;
+            }
+            if (encoderState == EncoderState::BODY && bodyBlockPos == bodyBlockCount)
+            {
+                auto c = encodeBodyInto(out + w, n - w);
+                if (c > 0)
+                {
+                    w += c;
+                    continue;
+                }
+            }
+            (void)getNextMessageFloat(out[w++]);
+        }
+        return w;
+    }
+
+    TIPSY_NODISCARD
+    EncoderResult terminateCurrentMessage()
+    {
+        if (encoderState == EncoderState::NO_MESSAGE)
+        {
+            return EncoderResult::ERROR_NO_MESSAGE_ACTIVE;
+        }
+        setState(EncoderState::NO_MESSAGE);
+        return EncoderResult::MESSAGE_TERMINATED;
+    }
+
+    bool isDormant() { return encoderState == EncoderState::NO_MESSAGE; }
+
+    /*
+     * Choose the body encoding, kVersion24Bit (the default) or kVersion28Bit, for subsequent
+     * messages. Only send version 2 to decoders which understand it. Returns false if the
+     * version is unknown or a message or session is active.
+     */
+    bool setEncodingVersion(uint16_t v)
+    {
+        if ((v != kVersion24Bit && v != kVersion28Bit) || !isDormant() || inSession)
+            return false;
+        encodingVersion = v;
+        return true;
+    }
+    uint16_t getEncodingVersion() const { return encodingVersion; }
+
+  private:
+    // The size and data checks every way of giving a body makes, in this order
+    static EncoderResult checkBody(uint64_t inDataBytes, bool dataMissing)
+    {
+        if (inDataBytes > kMaxMessageLength)
+        {
+            return EncoderResult::ERROR_MESSAGE_TOO_LARGE;
+        }
+        if ((inDataBytes > 0) && dataMissing)
+        {
+            return EncoderResult::ERROR_MISSING_DATA;
+        }
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    static EncoderResult checkMimeType(const char *inMimeType)
+    {
+        if (nullptr == inMimeType)
+        {
+            return EncoderResult::ERROR_MISSING_MIME_TYPE;
+        }
+        if (strlen(inMimeType) + 1 > kMaxMimeTypeSize)
+        {
+            return EncoderResult::ERROR_MIME_TYPE_TOO_LARGE;
+        }
+        return EncoderResult::MESSAGE_INITIATED;
+    }
+
+    uint32_t dataBytes{0};
+    const unsigned char *data{nullptr};
+    uint16_t encodingVersion{kVersion24Bit};
+    bool inSession{false};
+    bool preempting{false};
+
+    // A segmented body in place of data, and how far into it we are
+    const DataSegment *segments{nullptr};
+    size_t segmentIndex{0};
+    uint32_t segmentOffset{0};
+    unsigned char groupStage[7];
+
+    void startMessage(const char *inMimeType, uint32_t inDataBytes,
+                      const ContinuationFrame *frame = nullptr, bool openSession = false,
+                      const InternedMimeType *interned = nullptr)
+    {
+        dataBytes = inDataBytes;
+        bodyBlockPos = 0;
+        bodyBlockCount = 0;
+
+        // The header is fixed once we know the message, so encode it all now and the
+        // per sample cost of sending it is just an index walk
+        uint32_t h{0};
+        for (int i = 0; i < 3; ++i)
+            header[h++] = kMessageBeginSentinel;
+        header[h++] = kVersionSentinel;
+        if (frame)
+        {
+            header[h++] = FloatBytes((uint16_t)(encodingVersion | kContinuationFrameFlag));
+            header[h++] = FloatBytes(frame->sequence);
+            header[h++] = FloatBytes((uint32_t)(frame->offset & 0xffffff));
+            header[h++] = FloatBytes((uint32_t)(frame->offset >> 24));
+            header[h++] = FloatBytes((uint32_t)(frame->totalBytes & 0xffffff));
+            header[h++] = FloatBytes((uint32_t)(frame->totalBytes >> 24));
+        }
+        else
+        {
+            header[h++] = FloatBytes((uint16_t)(encodingVersion | (openSession ? kSessionFlag : 0) |
+                                                (interned ? kMimeTypeIdFlag : 0) |
+                                                (preempting ? kPreemptFlag : 0) |
+                                                (producer ? kStreamingFlag : 0)));
+        }
+        inSession = openSession;
+        header[h++] = kSizeSentinel;
+        header[h++] = FloatBytes(dataBytes);
+        header[h++] = kMimeTypeSentinel;
+        if (interned)
+        {
+            header[h++] = FloatBytes(interned->id |
+                                     (interned->announced ? 0 : kMimeTypeAnnounceBit));
+        }
+        if (!interned || !interned->announced)
+        {
+            auto ms = strlen(inMimeType) + 1;
+            header[h++] = FloatBytes((uint16_t)ms);
+            h += (uint32_t)encodeBytesToFloats((const uint8_t *)inMimeType, ms, header + h);
+        }
+        header[h++] = kBodySentinel;
+        headerSize = h;
+
+        setState(EncoderState::HEADER);
+    }
+
+    void startSessionMessage(uint32_t inDataBytes)
+    {
+        dataBytes = inDataBytes;
+        bodyBlockPos = 0;
+        bodyBlockCount = 0;
+
+        header[0] = kSizeSentinel;
+        header[1] = FloatBytes(dataBytes);
+        headerSize = 2;
+
+        setState(EncoderState::HEADER);
+    }
+
+    enum class EncoderState : uint16_t
+    {
+        NO_MESSAGE,
+        HEADER,
+        BODY,
+        END_MESSAGE
+    } encoderState{EncoderState::NO_MESSAGE};
+
+    // In the HEADER state the next header float, in BODY the count of data bytes already
+    // encoded into blocks
+    unsigned int pos{0};
+
+    // begin x3, version, size and mime sentinels and values, continuation fields, mime type
+    // ID, the mime type, body sentinel
+    static constexpr uint32_t kMaxHeaderFloats{3 + 2 + 2 + 2 + kContinuationFields + 1 +
+                                               (kMaxMimeTypeSize + 2) / 3 + 1};
+    float header[kMaxHeaderFloats];
+    uint32_t headerSize{0};
+
+    /*
+     * The body is encoded a block at a time with the bulk kernel and then handed out one
+     * float per call. The block is a whole number of 3 byte groups (or 7 byte pairs in the
+     * dense encoding) so only the final one can pad.
+     */
+    static constexpr uint32_t kBodyBlockFloats{64};
+    float bodyBlock[kBodyBlockFloats];
+    uint32_t bodyBlockPos{0}, bodyBlockCount{0};
+
+    // A streaming body pulls into this stage, which holds a block of either encoding.
+    // [0, streamFill) is pulled data and [0, streamTaken) of that has been encoded.
+    BodyProducer producer{nullptr};
+    void *producerData{nullptr};
+    static constexpr uint32_t kStreamStageBytes{kBodyBlockFloats / 2 * 7};
+    unsigned char streamStage[kStreamStageBytes];
+    uint32_t streamFill{0}, streamTaken{0};
+
+    void fillBodyBlock()
+    {
+        auto dense = encodingVersion == kVersion28Bit;
+        uint32_t blockBytes = dense ? kBodyBlockFloats / 2 * 7 : kBodyBlockFloats * 3;
+        auto remaining = dataBytes - pos;
+        auto n = remaining < blockBytes ? remaining : blockBytes;
+        bodyBlockCount = (uint32_t)encodeBody(bodyBlock, n);
+        bodyBlockPos = 0;
+    }
+
+    /*
+     * Point p at up to want bytes of body from pos and return how many. want is whole groups
+     * (3 bytes, or 7 for the dense encoding) unless it is the rest of the body. A segmented
+     * body hands out whole groups straight from the current segment and only copies a group
+     * which straddles segments, into groupStage.
+     */
+    uint32_t nextBodyBytes(uint32_t want, const unsigned char *&p)
+    {
+        if (producer)
+        {
+            return pullBodyBytes(want, p);
+        }
+        if (!segments)
+        {
+            p = data + pos;
+            return want;
+        }
+
+        while (segmentOffset == segments[segmentIndex].size)
+        {
+            segmentIndex++;
+            segmentOffset = 0;
+        }
+        const auto &seg = segments[segmentIndex];
+        uint32_t avail = seg.size - segmentOffset;
+        uint32_t group = encodingVersion == kVersion28Bit ? 7 : 3;
+        uint32_t take = avail >= want ? want : avail / group * group;
+        if (take > 0)
+        {
+            p = seg.data + segmentOffset;
+            segmentOffset += take;
+            return take;
+        }
+
+        take = want < group ? want : group;
+        for (uint32_t i = 0; i < take; ++i)
+        {
+            while (segmentOffset == segments[segmentIndex].size)
+            {
+                segmentIndex++;
+                segmentOffset = 0;
             }
+            groupStage[i] = segments[segmentIndex].data[segmentOffset++];
+        }
+        p = groupStage;
+        return take;
+    }
+
+    // As nextBodyBytes, but from the producer, so it can come up short or even empty
+    uint32_t pullBodyBytes(uint32_t want, const unsigned char *&p)
+    {
+        if (streamTaken > 0)
+        {
+            // at most a partial group is left over
+            memmove(streamStage, streamStage + streamTaken, streamFill - streamTaken);
+            streamFill -= streamTaken;
+            streamTaken = 0;
+        }
+
+        uint32_t group = encodingVersion == kVersion28Bit ? 7 : 3;
+        uint32_t cap = kStreamStageBytes / group * group;
+        cap = want < cap ? want : cap;
+        while (streamFill < cap)
+        {
+            auto got = producer(producerData, streamStage + streamFill, cap - streamFill);
+            if (got == 0)
+                break;
+            streamFill += got < cap - streamFill ? got : cap - streamFill;
+        }
+
+        streamTaken = streamFill == dataBytes - pos ? streamFill : streamFill / group * group;
+        p = streamStage;
+        return streamTaken;
+    }
+
+    /*
+     * Encode the next n body bytes into out, advancing pos, and return the floats written.
+     * Only a stalled streaming body encodes fewer than n.
+     */
+    size_t encodeBody(float *out, uint32_t n)
+    {
+        auto dense = encodingVersion == kVersion28Bit;
+        size_t c{0};
+        while (n > 0)
+        {
+            const unsigned char *p;
+            auto t = nextBodyBytes(n, p);
+            if (t == 0)
+                break;
+            if (dense)
+                c += encodeBytesToFloatsDense(p, t, out + c);
             else
+                c += encodeBytesToFloats(p, t, out + c);
+            pos += t;
+            n -= t;
+        }
+        return c;
+    }
+
+    // Encode as much of the remaining body as fits in n floats, in whole groups or pairs
+    // except at the very end. Returns 0 if not even one dense pair fits.
+    size_t encodeBodyInto(float *out, size_t n)
+    {
+        auto dense = encodingVersion == kVersion28Bit;
+        size_t fits = dense ? (n / 2) * 7 : n * 3;
+        size_t remaining = dataBytes - pos;
+        auto take = remaining < fits ? remaining : fits;
+        if (take == 0)
+            return 0;
+
+        auto c = encodeBody(out, (uint32_t)take);
+        if (pos == dataBytes)
+        {
+            setState(EncoderState::END_MESSAGE);
+        }
+        return c;
+    }
+
+    void setState(EncoderState s)
+    {
+        encoderState = s;
+        pos = 0;
+    }
+};
+
+struct ProtocolDecoder
+{
+    enum class DecoderResult : uint16_t
+    {
+        DORMANT = 1,
+        PARSING_HEADER,
+        HEADER_READY,
+        PARSING_BODY,
+        BODY_READY,
+        RESYNCING, // the float was thrown away hunting for the next message (see resync)
+        RESYNCED,  // the float completed a begin triple and started a message
+
+        ERROR_UNKNOWN = 0x100,
+        ERROR_INCOMPATIBLE_VERSION,
+        ERROR_MALFORMED_HEADER,
+        ERROR_DATA_TOO_LARGE,
+        ERROR_CHUNK_OUT_OF_SEQUENCE,
+        ERROR_UNKNOWN_MIME_TYPE_ID,
+        ERROR_NO_BUFFER_AVAILABLE
+    };
+
+    static bool isError(DecoderResult r) { return r >= DecoderResult::ERROR_UNKNOWN; }
+
+    // A result worth acting on and the index of the float which produced it
+    struct Event
+    {
+        DecoderResult result;
+        uint32_t offset;
+    };
+
+    /*
+     * Receiver for bodies of any size in constant memory. With a sink set, bodies are
+     * decoded into a small stage the caller provides and handed over kSinkStageBytes at a
+     * time rather than collected in the data buffer, which is then not needed. onHeader comes with
+     * HEADER_READY, onBodyChunk as the stage fills and with what is left at the end, and
+     * onComplete with BODY_READY, all from within readFloat(s). Any of them may be null.
+     * Urgent messages still go to the urgent buffer.
+     */
+    struct BodySink
+    {
+        void (*onHeader)(void *userData, const char *mimeType, uint32_t dataSize);
+        void (*onBodyChunk)(void *userData, const unsigned char *data, uint32_t size);
+        void (*onComplete)(void *userData);
+        void *userData;
+    };
+    // A multiple of both group sizes so the stage always fills on a group boundary
+    static constexpr uint32_t kSinkStageBytes{3 * 7 * 16};
+
+    /*
+     * Takes a copy of sink; stage must hold kSinkStageBytes and outlive its use. Applies from
+     * the next message; null goes back to the buffer.
+     */
+    bool provideBodySink(const BodySink *inSink, unsigned char *stage)
+    {
+        if (decoderState == DecoderState::START_BODY || suspended || (inSink && !stage))
+            return false;
+
+        hasSink = inSink != nullptr;
+        if (hasSink)
+            sink = *inSink;
+        sinkStage = hasSink ? stage : nullptr;
+        return true;
+    }
+
+    /*
+     * Take each body buffer from pool, sized from the message's size header, rather than
+     * using the data buffer. The decoder owns the buffer until BODY_READY; after that it is
+     * the consumer's, who may either leave it (the decoder releases it when the next message
+     * starts) or take it with detachPooledBuffer and release it to the pool when done. An
+     * empty pool gives ERROR_NO_BUFFER_AVAILABLE and the message is dropped. Urgent messages,
+     * continuation frames and sink deliveries do not use the pool.
+     */
+    bool provideBufferPool(BufferPool *inPool)
+    {
+        if (decoderState != DecoderState::DOING_NOTHING || suspended)
+            return false;
+
+        releasePooledBuffer();
+        pool = inPool;
+        return true;
+    }
+
+    // The finished message's pool buffer, now the caller's to release, or nullptr
+    unsigned char *detachPooledBuffer()
+    {
+        if (decoderState != DecoderState::DOING_NOTHING)
+            return nullptr;
+        auto b = pooledBuffer;
+        pooledBuffer = nullptr;
+        return b;
+    }
+
+    ProtocolDecoder()
+    {
+        // the hot state (see below) leads the decoder and ends inside its first cache line
+        static_assert(offsetof(ProtocolDecoder, dataStore) == 0, "Hot state must come first");
+        static_assert(offsetof(ProtocolDecoder, urgentMessage) < kCacheLineBytes,
+                      "Hot state must fit in one cache line");
+    }
+    /*
+     * Decoders move but do not copy, since only one can own a pool buffer. The moved to
+     * decoder carries on from where the other was, even mid message, and the moved from one
+     * is left as if new, with no buffers, sink, pool or tables.
+     */
+    ProtocolDecoder(ProtocolDecoder &&other) noexcept
+        : ProtocolDecoder(static_cast<const ProtocolDecoder &>(other))
+    {
+        takeOver(other);
+    }
+    ProtocolDecoder &operator=(ProtocolDecoder &&other) noexcept
+    {
+        if (this != &other)
+        {
+            releaseAllBuffers();
+            *this = static_cast<const ProtocolDecoder &>(other);
+            takeOver(other);
+        }
+        return *this;
+    }
+    ~ProtocolDecoder() { releaseAllBuffers(); }
+
+    /*
+     * Recovery from a broken stream, say a cable patched mid message or a dropped float.
+     * resync abandons any message in progress (a suspended one and any open session
+     * included) and throws input away, returning RESYNCING, until three kMessageBeginSentinel
+     * arrive in a row. The third returns RESYNCED and the message it opens decodes as usual.
+     * With setResyncOnError the decoder does this itself after any error.
+     *
+     * getDiscardedFloats is how many floats the last resync threw away before the triple,
+     * counting up until it is found. skipResyncFloats is the block fast path, as
+     * skipDormantFloats but for a resyncing decoder.
+     */
+    void resync()
+    {
+        // a finished message keeps its buffer, as it would without the resync
+        if (decoderState != DecoderState::DOING_NOTHING || suspended)
+            releaseAllBuffers();
+        suspended = resumePending = urgentMessage = false;
+        inSession = false;
+        messageComplete = false;
+        setState(DecoderState::DOING_NOTHING);
+
+        resyncing = true;
+        beginRun = 0;
+        discardedFloats = 0;
+    }
+    void setResyncOnError(bool r) { resyncOnError = r; }
+    bool isResyncing() const { return resyncing; }
+    uint32_t getDiscardedFloats() const { return discardedFloats; }
+
+    size_t skipResyncFloats(const float *f, size_t n)
+    {
+        if (!resyncing)
+            return 0;
+
+        auto &k = activeKernels();
+        size_t i{0};
+        while (i < n)
+        {
+            auto j = k.findFloatInRange(f + i, n - i, kMessageBeginSentinel,
+                                        kMessageBeginSentinel);
+            if (j > 0)
             {
-                f = FloatBytes(dataBytes);
-                setState(EncoderState::HEADER_MIMETYPE);
+                // a partial run of begin sentinels is broken, so was garbage too
+                discardedFloats += beginRun + (uint32_t)j;
+                beginRun = 0;
+                i += j;
             }
-            return EncoderResult::ENCODING_MESSAGE;
+            // the last of the triple is left for readFloat to start the message with
+            if (i == n || beginRun == 2)
+                break;
+            beginRun++;
+            i++;
         }
-        break;
-        case EncoderState::HEADER_MIMETYPE:
+        return i;
+    }
+
+    bool provideDataBuffer(unsigned char *data, uint32_t size)
+    {
+        if ((decoderState == DecoderState::START_BODY && !urgentMessage) || suspended)
+            return false;
+
+        dataStore = bufferStart = data;
+        dataStoreSize = bufferSize = size;
+        return true;
+    }
+
+    /*
+     * Storage for interned mime types: entries blocks of kMaxMimeTypeSize bytes, one per ID
+     * from 0. Announcements for IDs past the end are still decoded but not remembered, so
+     * later references to them give ERROR_UNKNOWN_MIME_TYPE_ID. The table is cleared here;
+     * provide it before any traffic as it can only be swapped while dormant.
+     */
+    bool provideMimeTypeTable(char *table, uint16_t entries)
+    {
+        if (decoderState != DecoderState::DOING_NOTHING)
+            return false;
+
+        mimeTable = table;
+        mimeTableEntries = table ? entries : 0;
+        for (uint32_t i = 0; i < mimeTableEntries; ++i)
+            mimeTable[i * kMaxMimeTypeSize] = 0;
+        mimeView = homeMimeBuffer();
+        inSession = false;
+        return true;
+    }
+
+    /*
+     * Storage for sent mime types. The decoder itself holds kInlineMimeTypeSize bytes, which
+     * take a mime type of up to 29 characters; a longer one gives ERROR_DATA_TOO_LARGE unless
+     * a buffer of kMaxMimeTypeSize bytes is provided here. It must outlive its use; nullptr
+     * goes back to the inline storage. Interned and urgent mime types are written elsewhere
+     * so need neither. Only while dormant, and getMimeType is empty until the next message.
+     */
+    bool provideMimeTypeBuffer(char *buffer)
+    {
+        if (decoderState != DecoderState::DOING_NOTHING || suspended)
+            return false;
+
+        mimeBuffer = buffer;
+        mimeView = mimeDest = homeMimeBuffer();
+        mimeDest[0] = 0;
+        return true;
+    }
+
+    /*
+     * Urgent messages. An interrupted body is set aside in an UrgentState when the begin
+     * sentinel arrives and kept if the version turns out urgent. The urgent message uses its
+     * own buffer and the UrgentState's mime type so the set aside one stays intact, and the
+     * body resumes on the float after the urgent message ends. The contents of an
+     * UrgentState are the decoder's; the caller only provides the memory.
+     */
+    struct UrgentState
+    {
+        char mimeType[kMaxMimeTypeSize];
+        struct SuspendedBody
+        {
+            uint32_t pos, dataSize;
+            uint16_t version;
+            unsigned char *dataStore;
+            uint32_t dataStoreSize;
+            uint8_t denseNibble;
+            const char *mimeView;
+            uint16_t mimeTypeId;
+            bool continuation, inSession, sinking, messageFailed;
+            uint32_t sinkDelivered;
+            unsigned char *pooledBuffer;
+            ContinuationFrame frame;
+        } suspendedBody;
+    };
+
+    /*
+     * The buffer and state for urgent messages (see kPreemptFlag), which arrive while the
+     * regular buffer may hold half a body; both must outlive their use. Without them every
+     * urgent message gives ERROR_DATA_TOO_LARGE.
+     */
+    bool provideUrgentDataBuffer(unsigned char *data, uint32_t size, UrgentState *state)
+    {
+        if ((decoderState == DecoderState::START_BODY && urgentMessage) || suspended ||
+            (data && !state))
+            return false;
+
+        urgentStore = data;
+        urgentStoreSize = size;
+        urgent = state;
+        return true;
+    }
+
+    /*
+     * Whether the current (or last) message is urgent. Its BODY_READY may come in the middle
+     * of another body, which resumes with the next float; until then the getters describe
+     * the urgent message.
+     */
+    bool isUrgentMessage() const { return urgentMessage; }
+    // Whether a body is set aside for an urgent message
+    bool hasSuspendedMessage() const { return suspended; }
+
+    const char *getMimeType() const { return mimeView; }
+    // Where the body of the current (or last) message is written
+    const unsigned char *getData() const { return dataStore; }
+    // The mime type ID of the current (or last) message, or kNoMimeTypeId if it sent a string
+    uint16_t getMimeTypeId() const { return mimeTypeId; }
+    // The mime type announced for id, or nullptr if there is none
+    const char *getInternedMimeType(uint16_t id) const
+    {
+        if (id >= mimeTableEntries || mimeTable[id * kMaxMimeTypeSize] == 0)
+            return nullptr;
+        return mimeTable + id * kMaxMimeTypeSize;
+    }
+    uint32_t getDataSize() const { return dataSize + sinkDelivered; }
+    // The body encoding version of the current (or last) message
+    uint16_t getVersion() const { return version; }
+
+    /*
+     * Whether the current (or last) message is a continuation frame, and if so where it sits
+     * in the whole. Its body is written at getContinuationFrame().offset in the data buffer
+     * rather than at the start, so frames in order rebuild the message in place.
+     */
+    bool isContinuationFrame() const { return continuation; }
+    const ContinuationFrame &getContinuationFrame() const { return frame; }
+
+    /*
+     * Whether a session is open, so that short header messages are accepted. getMimeType and
+     * getVersion then stay those of the message which opened it.
+     */
+    bool isInSession() const { return inSession; }
+
+    /*
+     * Bulk body read. If the decoder is in the middle of a body this consumes the leading run
+     * of whole body floats in f (stopping at the first sentinel and before the final, possibly
+     * partial, group) and decodes them straight into the data buffer (or the sink stage,
+     * passing it on each time it fills). It returns the number of floats consumed, which are
+     * exactly those for which readFloat would have returned PARSING_BODY; pass the remainder
+     * through readFloat as usual.
+     */
+    size_t readBodyFloats(const float *f, size_t n)
+    {
+        if (resumePending)
+            resumeBody();
+        if (decoderState != DecoderState::START_BODY)
+            return 0;
+        if (!sinking)
+            return readBodyFloatsIntoStore(f, n);
+
+        size_t c{0};
+        while (c < n)
+        {
+            flushFullStage();
+            auto k = readBodyFloatsIntoStore(f + c, n - c);
+            if (k == 0)
+                break;
+            c += k;
+        }
+        return c;
+    }
+
+  private:
+    // readBodyFloats up to the end of dataStore
+    size_t readBodyFloatsIntoStore(const float *f, size_t n)
+    {
+        if (version == kVersion28Bit)
+            return readDenseBodyFloats(f, n);
+        if (pos + 3 >= dataSize || pos >= dataStoreSize)
+            return 0;
+
+        size_t groups = (dataSize - pos - 1) / 3;
+        size_t room = (dataStoreSize - pos) / 3;
+        groups = room < groups ? room : groups;
+        if (n > groups)
+            n = groups;
+
+        // with no sentinels to accept this stops at the first non data float, stalls included
+        auto k = activeKernels().validateFloats(f, n, ENCODED_FLOAT_MINIMUM_MAGNITUDE,
+                                                maximumEncodedFloat(), nullptr, 0, nullptr);
+
+        decodeFloatsToBytes(f, k, dataStore + pos);
+        pos += (uint32_t)(3 * k);
+        return k;
+    }
+
+  public:
+    /*
+     * Idle input fast path. While the decoder is dormant it ignores everything but sentinels,
+     * so this scans f for the first float which could be one and returns how many floats
+     * precede it; readFloat would have returned DORMANT for each of those. Feed f[result]
+     * onwards through readFloat as usual. Returns 0 if the decoder is not dormant.
+     */
+    size_t skipDormantFloats(const float *f, size_t n)
+    {
+        if (resumePending)
+            resumeBody();
+        if (decoderState != DecoderState::DOING_NOTHING)
+            return 0;
+
+        auto &k = activeKernels();
+        size_t i{0};
+        while (i < n)
         {
-            if (pos == 0)
-            {
-                f = kMimeTypeSentinel;
-                pos++;
-            }
-            else if (pos == 1)
-            {
-                f = FloatBytes(mimeTypeSize);
-                pos++;
-            }
-            else
-            {
-                auto dp = (uint32_t)(pos - 2);
-                if (dp + 3 < mimeTypeSize)
-                {
-                    auto mt = (unsigned char *)(mimeType + dp);
-                    f = FloatBytes(mt[0], mt[1], mt[2]);
-
-                    pos += 3;
-                    if (pos - 1 == mimeTypeSize)
-                    {
-                        setState(EncoderState::BODY);
-                    }
-                }
-                else
-                {
-                    char d[3]{0, 0, 0};
-                    int i{0};
-                    for (; dp < mimeTypeSize; ++dp, ++i)
-                    {
-                        d[i] = mimeType[dp];
-                    }
-
-                    f = FloatBytes(d[0], d[1], d[2]);
-                    setState(EncoderState::BODY);
-                }
-            }
-            return EncoderResult::ENCODING_MESSAGE;
+            i += k.findFloatInRange(f + i, n - i, kLowestSentinel, kHighestSentinel);
+            if (i == n || isValidSentinel(f[i]))
+                break;
+            i++;
         }
-        break;
-        case EncoderState::BODY:
+        return i;
+    }
+
+    /*
+     * Block version of readFloat. Consumes f, using the resync, dormant and body fast paths
+     * where it can, and records each HEADER_READY, BODY_READY, RESYNCED and error in events.
+     * Returns the number of events. It always stops straight after a BODY_READY, since the
+     * next message reuses the buffer, and after the maxEvents-th event (maxEvents must be at
+     * least 1). If the last event is either of those carry on from its offset + 1; otherwise
+     * all of f was read.
+     */
+    size_t readFloats(const float *f, size_t n, Event *events, size_t maxEvents)
+    {
+        assert(maxEvents > 0);
+        size_t i{0}, e{0};
+        while (i < n)
         {
-            if (pos == 0)
-            {
-                f = kBodySentinel;
-                pos++;
-            }
-            else if (pos == dataBytes + 1)
-            {
-                setState(EncoderState::END_MESSAGE);
-            }
-            else if (pos + 2 < dataBytes)
-            {
-                auto d = data + pos - 1;
-                f = FloatBytes(d[0], d[1], d[2]);
-                pos += 3;
-                if (pos - 1 == dataBytes)
-                {
-                    setState(EncoderState::END_MESSAGE);
-                }
-            }
-            else
+            i += skipResyncFloats(f + i, n - i);
+            i += skipDormantFloats(f + i, n - i);
+            i += readBodyFloats(f + i, n - i);
+            if (i == n)
+                break;
+
+            auto r = readFloat(f[i]);
+            if (r == DecoderResult::HEADER_READY || r == DecoderResult::BODY_READY ||
+                r == DecoderResult::RESYNCED || isError(r))
             {
-                unsigned char d[3]{0, 0, 0};
-                int i{0};
-                for (unsigned int dpos = pos - 1; dpos < dataBytes; ++dpos, ++i)
-                {
-                    d[i] = data[dpos];
-                }
-                f = FloatBytes(d[0], d[1], d[2]);
-                setState(EncoderState::END_MESSAGE);
+                events[e++] = {r, (uint32_t)i};
+                if (e == maxEvents || r == DecoderResult::BODY_READY)
+                    break;
             }
-            return EncoderResult::ENCODING_MESSAGE;
-        }
-        break;
-        case EncoderState::END_MESSAGE:
-        {
-            f = kEndMessageSentinel;
-            setState(EncoderState::NO_MESSAGE);
-            return EncoderResult::MESSAGE_COMPLETE;
-        }
-        break;
+            i++;
         }
-
-        return EncoderResult::ERROR_UNKNOWN;
+        return e;
     }
 
     TIPSY_NODISCARD
-    EncoderResult terminateCurrentMessage()
+    DecoderResult readFloat(float f)
     {
-        if (encoderState == EncoderState::NO_MESSAGE)
+        if (resyncing)
+            return resyncFloat(f);
+        auto r = decodeFloat(f);
+        if (isError(r))
         {
-            return EncoderResult::ERROR_NO_MESSAGE_ACTIVE;
+            messageFailed = true;
+            if (resyncOnError)
+                resync();
         }
-        setState(EncoderState::NO_MESSAGE);
-        return EncoderResult::MESSAGE_TERMINATED;
+        return r;
     }
 
-    bool isDormant() { return encoderState == EncoderState::NO_MESSAGE; }
+    /*
+     * Whether the message which last gave BODY_READY arrived whole and without an error
+     * along the way. BODY_READY comes with every end sentinel, so a message whose size was
+     * refused, or whose body was cut short, still gets one.
+     */
+    bool isMessageComplete() const { return messageComplete; }
 
   private:
-    const char *mimeType{nullptr};
-    uint32_t dataBytes{0};
-    uint16_t mimeTypeSize{0};
-    const unsigned char *data{nullptr};
+    // Member by member, for the moves only
+    ProtocolDecoder(const ProtocolDecoder &) = default;
+    ProtocolDecoder &operator=(const ProtocolDecoder &) = default;
 
-    enum class EncoderState : uint16_t
+    // After copying other's members: use our own mime type buffer and leave other owning
+    // nothing
+    void takeOver(ProtocolDecoder &other) noexcept
     {
-        NO_MESSAGE,
-        START_MESSAGE,
-        HEADER_VERSION,
-        HEADER_SIZE,
-        HEADER_MIMETYPE,
-        BODY,
-        END_MESSAGE
-    } encoderState{EncoderState::NO_MESSAGE};
+        if (mimeDest == other.mimetype)
+            mimeDest = mimetype;
+        if (mimeView == other.mimetype)
+            mimeView = mimetype;
+        if (suspended && urgent->suspendedBody.mimeView == other.mimetype)
+            urgent->suspendedBody.mimeView = mimetype;
 
-    unsigned int pos{0};
-
-    void setState(EncoderState s)
-    {
-        encoderState = s;
-        pos = 0;
+        other.pooledBuffer = nullptr;
+        other.suspended = false;
+        ProtocolDecoder fresh;
+        other = fresh;
+        other.mimeView = other.mimeDest = other.mimetype;
     }
-};
 
-struct ProtocolDecoder
-{
-    enum class DecoderResult : uint16_t
+    enum class DecoderState : uint8_t
     {
-        DORMANT = 1,
-        PARSING_HEADER,
-        HEADER_READY,
-        PARSING_BODY,
-        BODY_READY,
-
-        ERROR_UNKNOWN = 0x100,
-        ERROR_INCOMPATIBLE_VERSION,
-        ERROR_MALFORMED_HEADER,
-        ERROR_DATA_TOO_LARGE
+        DOING_NOTHING,
+        START_VERSION,
+        START_HEADER,
+        START_SIZE,
+        START_MIMETYPE,
+        START_BODY
     };
 
-    static bool isError(DecoderResult r) { return r >= DecoderResult::ERROR_UNKNOWN; }
+    /*
+     * Hot state. Everything a float on an idle cable or in the middle of a body touches is
+     * declared here, ahead of every other member, and fits in one cache line. Header state
+     * and the mime type buffer come after it, and the sink stage and urgent state are the
+     * caller's, so a host running thousands of decoders brings in a line per decoder per
+     * sample rather than buffers which only a header needs. From C++17 the alignment puts
+     * the block at the start of a line; before that new cannot align it, so it may straddle
+     * two. The constructor checks that the block fits.
+     *
+     * dataStore is where this message's body goes: the buffer, or for a continuation frame
+     * the part of it from the frame's offset. denseNibble is the version 2 body state (see
+     * readDenseBodyFloat).
+     */
+    static constexpr size_t kCacheLineBytes{64};
+    TIPSY_CACHE_LINE_ALIGNED unsigned char *dataStore{nullptr};
+    uint32_t pos{0}, dataSize{0}, dataStoreSize{0};
+    uint16_t version{0};
+    DecoderState decoderState{DecoderState::DOING_NOTHING};
+    uint8_t denseNibble{0};
+    bool resumePending{false}, resyncing{false}, sinking{false}, messageFailed{false};
+    bool suspended{false}, urgentMessage{false};
 
-    bool provideDataBuffer(unsigned char *data, uint32_t size)
-    {
-        if (decoderState == DecoderState::START_BODY)
-            return false;
+    bool resyncOnError{false}, messageComplete{false};
+    uint8_t beginRun{0};
+    uint32_t discardedFloats{0};
 
-        dataStore = data;
-        dataStoreSize = size;
-        return true;
+    DecoderResult resyncFloat(float f)
+    {
+        if (f != kMessageBeginSentinel)
+        {
+            discardedFloats += beginRun + 1;
+            beginRun = 0;
+            return DecoderResult::RESYNCING;
+        }
+        if (++beginRun < 3)
+            return DecoderResult::RESYNCING;
+        resyncing = false;
+        beginRun = 0;
+        decodeFloat(f);
+        return DecoderResult::RESYNCED;
     }
 
-    const char *getMimeType() const { return mimetype; }
-    uint32_t getDataSize() const { return dataSize; }
-
-    TIPSY_NODISCARD
-    DecoderResult readFloat(float f)
+    DecoderResult decodeFloat(float f)
     {
         assert(kMessageBeginSentinel > tipsy::maximumEncodedFloat());
 
+        if (resumePending)
+            resumeBody();
+
+        if (decoderState == DecoderState::DOING_NOTHING &&
+            (f < kLowestSentinel || f > kHighestSentinel))
+        {
+            return DecoderResult::DORMANT;
+        }
+
         if (f == kMessageBeginSentinel)
         {
+            // this may be an urgent message cutting in, which we only learn from its version
+            if (decoderState == DecoderState::START_BODY && !urgentMessage && !suspended &&
+                urgent)
+                suspendBody();
+            else
+                releasePooledBuffer();
+            urgentMessage = false;
+
             setState(DecoderState::START_HEADER);
             dataSize = 0;
-            memset(mimetype, 0, sizeof(mimetype));
+            messageFailed = false;
+            // the mime type is only cleared when one is sent, so ID references skip it
+            mimeView = mimeDest = suspended ? urgent->mimeType : homeMimeBuffer();
+            mimeDest[0] = 0;
+            mimeTypeId = kNoMimeTypeId;
+            mimeIdFlag = false;
             version = -1;
+            continuation = false;
+            continuationFields = false;
+            sessionFlag = false;
+            inSession = false;
+            sinking = hasSink;
+            sinkDelivered = 0;
+            dataStore = sinking ? sinkStage : bufferStart;
+            dataStoreSize = sinking ? kSinkStageBytes : bufferSize;
             return DecoderResult::PARSING_HEADER;
         }
 
@@ -358,6 +1458,9 @@ struct ProtocolDecoder
         }
         if (f == kSizeSentinel)
         {
+            // outside a full header this starts a session message
+            shortHeader = decoderState == DecoderState::DOING_NOTHING ||
+                          decoderState == DecoderState::START_BODY;
             setState(DecoderState::START_SIZE);
             return DecoderResult::PARSING_HEADER;
         }
@@ -368,12 +1471,20 @@ struct ProtocolDecoder
         }
         if (f == kBodySentinel)
         {
+            inSession = sessionFlag;
             setState(DecoderState::START_BODY);
+            if (sinking && sink.onHeader)
+                sink.onHeader(sink.userData, mimeView, dataSize);
             return DecoderResult::HEADER_READY;
         }
         if (f == kEndMessageSentinel)
         {
+            messageComplete = !messageFailed && decoderState == DecoderState::START_BODY &&
+                              bodyBytesReceived() >= dataSize;
+            if (sinking && decoderState == DecoderState::START_BODY)
+                finishSinkBody();
             setState(DecoderState::DOING_NOTHING);
+            resumePending = suspended && urgentMessage;
             return DecoderResult::BODY_READY;
         }
 
@@ -387,7 +1498,32 @@ struct ProtocolDecoder
             if (pos == 0)
             {
                 version = uint16_FromFloat(f);
+                continuationFields = (version & kContinuationFrameFlag) != 0;
+                sessionFlag = (version & kSessionFlag) != 0;
+                mimeIdFlag = (version & kMimeTypeIdFlag) != 0;
+                urgentMessage = (version & kPreemptFlag) != 0;
+                version &= ~(kContinuationFrameFlag | kSessionFlag | kMimeTypeIdFlag |
+                             kPreemptFlag | kStreamingFlag);
                 pos++;
+                if (urgentMessage && continuationFields)
+                {
+                    return DecoderResult::ERROR_MALFORMED_HEADER;
+                }
+                if (urgentMessage)
+                {
+                    sinking = false;
+                    dataStore = urgentStore;
+                    dataStoreSize = urgentStoreSize;
+                }
+                else if (suspended)
+                {
+                    // not urgent after all, so the interrupted body is abandoned
+                    suspended = false;
+                    if (pool)
+                        pool->release(urgent->suspendedBody.pooledBuffer);
+                    mimeView = mimeDest = homeMimeBuffer();
+                    mimeDest[0] = 0;
+                }
                 if (version > 0 && version <= kVersion)
                 {
                     return DecoderResult::PARSING_HEADER;
@@ -397,6 +1533,10 @@ struct ProtocolDecoder
                     return DecoderResult::ERROR_INCOMPATIBLE_VERSION;
                 }
             }
+            else if (continuationFields && pos <= kContinuationFields)
+            {
+                return readContinuationField(f);
+            }
             else
             {
                 return DecoderResult::ERROR_MALFORMED_HEADER;
@@ -404,12 +1544,38 @@ struct ProtocolDecoder
             break;
 
         case DecoderState::START_SIZE:
+            if (shortHeader && !inSession)
+            {
+                return DecoderResult::ERROR_MALFORMED_HEADER;
+            }
+            if (continuationFields && !continuation)
+            {
+                return DecoderResult::ERROR_MALFORMED_HEADER;
+            }
             if (pos == 0)
             {
                 dataSize = uint32_FromFloat(f);
-                if (dataSize >= dataStoreSize)
+                if (shortHeader)
+                {
+                    sinkDelivered = 0;
+                    messageFailed = false;
+                }
+                if (pool && !sinking && !urgentMessage && !continuation)
+                {
+                    if (!acquirePooledBuffer())
+                        return DecoderResult::ERROR_NO_BUFFER_AVAILABLE;
+                }
+                else if (!sinking && dataSize >= dataStoreSize)
                     return DecoderResult::ERROR_DATA_TOO_LARGE;
                 pos++;
+                if (shortHeader)
+                {
+                    // the size is all a session message header has
+                    setState(DecoderState::START_BODY);
+                    if (sinking && sink.onHeader)
+                        sink.onHeader(sink.userData, mimeView, dataSize);
+                    return DecoderResult::HEADER_READY;
+                }
                 return DecoderResult::PARSING_HEADER;
             }
             else
@@ -420,9 +1586,19 @@ struct ProtocolDecoder
 
         case DecoderState::START_MIMETYPE:
         {
+            if (mimeIdFlag && mimeTypeId == kNoMimeTypeId)
+            {
+                return readMimeTypeId(f);
+            }
             if (pos == 0)
             {
+                if (mimeIdFlag && mimeView != mimeDest)
+                {
+                    // a reference carries nothing after its ID
+                    return DecoderResult::ERROR_MALFORMED_HEADER;
+                }
                 mimetypeSize = uint16_FromFloat(f);
+                memset(mimeDest, 0, mimeDestSize());
                 pos++;
                 return DecoderResult::PARSING_HEADER;
             }
@@ -432,16 +1608,17 @@ struct ProtocolDecoder
                 {
                     return DecoderResult::ERROR_MALFORMED_HEADER;
                 }
-                if (pos >= kMaxMimeTypeSize - 4)
+                // the three bytes this writes must leave the last one as a terminator
+                if (pos + 2 >= mimeDestSize())
                 {
                     return DecoderResult::ERROR_DATA_TOO_LARGE;
                 }
 
                 auto wp = pos - 1;
                 auto float_bytes = FloatBytes(f);
-                mimetype[wp] = float_bytes.first();
-                mimetype[wp + 1] = float_bytes.second();
-                mimetype[wp + 2] = float_bytes.third();
+                mimeDest[wp] = float_bytes.first();
+                mimeDest[wp + 1] = float_bytes.second();
+                mimeDest[wp + 2] = float_bytes.third();
 
                 pos += 3;
                 return DecoderResult::PARSING_HEADER;
@@ -449,12 +1626,23 @@ struct ProtocolDecoder
             break;
         }
         case DecoderState::START_BODY:
-            if (pos < dataSize - 3)
+            // 0 is never a data float; it is a streaming encoder waiting on its producer
+            if (f == 0.f)
             {
-                auto float_bytes = FloatBytes(f);
-                dataStore[pos++] = float_bytes.first();
-                dataStore[pos++] = float_bytes.second();
-                dataStore[pos++] = float_bytes.third();
+                return DecoderResult::PARSING_BODY;
+            }
+            if (sinking)
+            {
+                flushFullStage();
+            }
+            if (version == kVersion28Bit)
+            {
+                return readDenseBodyFloat(f);
+            }
+            if (pos + 3 < dataSize && pos + 3 <= dataStoreSize)
+            {
+                detail::decodeFloatsToBytesScalar(&f, 1, dataStore + pos);
+                pos += 3;
                 return DecoderResult::PARSING_BODY;
             }
             else if (pos < dataSize && pos < dataStoreSize)
@@ -485,25 +1673,272 @@ struct ProtocolDecoder
         return DecoderResult::ERROR_UNKNOWN;
     }
 
-  private:
-    enum class DecoderState : uint8_t
+    // Body bytes decoded so far (since the last sink delivery, if sinking)
+    uint32_t bodyBytesReceived() const
     {
-        DOING_NOTHING,
-        START_VERSION,
-        START_HEADER,
-        START_SIZE,
-        START_MIMETYPE,
-        START_BODY
-    } decoderState{DecoderState::DOING_NOTHING};
-
-    uint32_t pos{0};
-    uint16_t version;
-    uint32_t dataSize;
-    char mimetype[kMaxMimeTypeSize];
+        return version == kVersion28Bit ? (pos / 2) * 7 + (pos % 2) * 3 : pos;
+    }
     uint16_t mimetypeSize;
 
-    unsigned char *dataStore{nullptr};
-    uint32_t dataStoreSize{0};
+    // Urgent messages, see UrgentState
+    unsigned char *urgentStore{nullptr};
+    uint32_t urgentStoreSize{0};
+    UrgentState *urgent{nullptr};
+
+    void suspendBody()
+    {
+        auto &b = urgent->suspendedBody;
+        b.pos = pos;
+        b.dataSize = dataSize;
+        b.version = version;
+        b.dataStore = dataStore;
+        b.dataStoreSize = dataStoreSize;
+        b.denseNibble = denseNibble;
+        b.mimeView = mimeView;
+        b.mimeTypeId = mimeTypeId;
+        b.continuation = continuation;
+        b.inSession = inSession;
+        b.sinking = sinking;
+        b.messageFailed = messageFailed;
+        b.sinkDelivered = sinkDelivered;
+        b.pooledBuffer = pooledBuffer;
+        b.frame = frame;
+        pooledBuffer = nullptr;
+        suspended = true;
+    }
+
+    void resumeBody()
+    {
+        auto &b = urgent->suspendedBody;
+        setState(DecoderState::START_BODY);
+        pos = b.pos;
+        dataSize = b.dataSize;
+        version = b.version;
+        dataStore = b.dataStore;
+        dataStoreSize = b.dataStoreSize;
+        denseNibble = b.denseNibble;
+        mimeView = b.mimeView;
+        mimeTypeId = b.mimeTypeId;
+        continuation = b.continuation;
+        inSession = b.inSession;
+        sinking = b.sinking;
+        messageFailed = b.messageFailed;
+        sinkDelivered = b.sinkDelivered;
+        frame = b.frame;
+        releasePooledBuffer();
+        pooledBuffer = b.pooledBuffer;
+        urgentMessage = false;
+        suspended = false;
+        resumePending = false;
+    }
+
+    // The pool buffer of the current message, or the last one if not yet detached
+    BufferPool *pool{nullptr};
+    unsigned char *pooledBuffer{nullptr};
+
+    bool acquirePooledBuffer()
+    {
+        releasePooledBuffer();
+        uint32_t capacity{0};
+        pooledBuffer = pool->acquire(dataSize > 0 ? dataSize : 1, &capacity);
+        dataStore = pooledBuffer;
+        dataStoreSize = pooledBuffer ? capacity : 0;
+        return pooledBuffer != nullptr;
+    }
+
+    void releasePooledBuffer()
+    {
+        if (pool && pooledBuffer)
+            pool->release(pooledBuffer);
+        pooledBuffer = nullptr;
+    }
+
+    // As releasePooledBuffer, and the interrupted body's buffer too while one is suspended
+    void releaseAllBuffers()
+    {
+        releasePooledBuffer();
+        if (suspended && pool)
+            pool->release(urgent->suspendedBody.pooledBuffer);
+        if (suspended)
+            urgent->suspendedBody.pooledBuffer = nullptr;
+    }
+
+    /*
+     * Sink delivery. The stage is dataStore while sinking; each time it fills it goes to the
+     * sink and dataSize and pos are rebased to the rest of the body, so the body decode
+     * paths never know. sinkDelivered counts the bytes already handed over.
+     */
+    BodySink sink{nullptr, nullptr, nullptr, nullptr};
+    unsigned char *sinkStage{nullptr};
+    bool hasSink{false};
+    uint32_t sinkDelivered{0};
+
+    void deliverStage(uint32_t bytes)
+    {
+        if (bytes > 0 && sink.onBodyChunk)
+            sink.onBodyChunk(sink.userData, sinkStage, bytes);
+        sinkDelivered += bytes;
+        dataSize -= bytes;
+    }
+
+    void flushFullStage()
+    {
+        // a stage holding the end of the body waits for finishSinkBody
+        if (dataSize <= kSinkStageBytes)
+            return;
+        if (version == kVersion28Bit)
+        {
+            if (pos < kSinkStageBytes / 7 * 2)
+                return;
+        }
+        else if (pos < kSinkStageBytes)
+        {
+            return;
+        }
+        deliverStage(kSinkStageBytes);
+        pos = 0;
+    }
+
+    void finishSinkBody()
+    {
+        auto got = bodyBytesReceived();
+        deliverStage(got < dataSize ? got : dataSize);
+        if (sink.onComplete)
+            sink.onComplete(sink.userData);
+    }
+
+    // mimeDest is where a sent mime type is written and mimeView what getMimeType returns;
+    // both are the home buffer (mimeBuffer if provided, else the inline mimetype) unless
+    // the message interns its mime type or is urgent
+    char mimetype[kInlineMimeTypeSize]{};
+    char *mimeBuffer{nullptr};
+    char *mimeDest{mimetype};
+    const char *mimeView{mimetype};
+    char *mimeTable{nullptr};
+    uint32_t mimeTableEntries{0};
+    uint16_t mimeTypeId{kNoMimeTypeId};
+    bool mimeIdFlag{false};
+
+    char *homeMimeBuffer() { return mimeBuffer ? mimeBuffer : mimetype; }
+    size_t mimeDestSize() const
+    {
+        return mimeDest == mimetype ? kInlineMimeTypeSize : kMaxMimeTypeSize;
+    }
+
+    DecoderResult readMimeTypeId(float f)
+    {
+        auto v = uint32_FromFloat(f);
+        auto id = (uint16_t)(v & 0xFFFF);
+        if (id == kNoMimeTypeId || (v & ~(kMimeTypeAnnounceBit | 0xFFFF)))
+            return DecoderResult::ERROR_MALFORMED_HEADER;
+
+        mimeTypeId = id;
+        auto entry = id < mimeTableEntries ? mimeTable + id * kMaxMimeTypeSize : nullptr;
+        if (v & kMimeTypeAnnounceBit)
+        {
+            if (entry)
+                mimeDest = entry;
+            mimeView = mimeDest;
+            return DecoderResult::PARSING_HEADER;
+        }
+        if (!entry || entry[0] == 0)
+            return DecoderResult::ERROR_UNKNOWN_MIME_TYPE_ID;
+        mimeView = entry;
+        return DecoderResult::PARSING_HEADER;
+    }
+
+    unsigned char *bufferStart{nullptr};
+    uint32_t bufferSize{0};
+
+    // continuationFields is set by the version flag, continuation once all of them arrive
+    bool continuation{false}, continuationFields{false};
+    ContinuationFrame frame{0, 0, 0};
+
+    // sessionFlag is set by the version flag and opens the session once the header is done;
+    // shortHeader marks a size sentinel arriving outside a full header
+    bool sessionFlag{false}, inSession{false}, shortHeader{false};
+
+    DecoderResult readContinuationField(float f)
+    {
+        uint64_t v = uint32_FromFloat(f);
+        switch (pos++)
+        {
+        case 1:
+            frame.sequence = (uint32_t)v;
+            break;
+        case 2:
+            frame.offset = v;
+            break;
+        case 3:
+            frame.offset |= v << 24;
+            break;
+        case 4:
+            frame.totalBytes = v;
+            break;
+        default:
+            frame.totalBytes |= v << 24;
+            continuation = true;
+            if (sinking)
+                break;
+            if (frame.offset > frame.totalBytes || frame.offset >= bufferSize)
+                return DecoderResult::ERROR_DATA_TOO_LARGE;
+            dataStore = bufferStart + frame.offset;
+            dataStoreSize = bufferSize - (uint32_t)frame.offset;
+            break;
+        }
+        return DecoderResult::PARSING_HEADER;
+    }
+
+    /*
+     * Version 2 bodies. Here pos counts floats rather than bytes: float pos is half pos % 2
+     * of the pair starting at byte 7 * (pos / 2). The first half's exponent nibble is held
+     * until the second half arrives to complete byte 6 (in denseNibble).
+     */
+    DecoderResult readDenseBodyFloat(float f)
+    {
+        auto limit = dataSize < dataStoreSize ? dataSize : dataStoreSize;
+        uint32_t base = (pos / 2) * 7;
+        if (base >= limit)
+            return DecoderResult::ERROR_DATA_TOO_LARGE;
+
+        auto w = denseFloatToWord(f);
+        auto off = base + (pos % 2) * 3;
+        for (uint32_t i = 0; i < 3 && off + i < limit; ++i)
+            dataStore[off + i] = (w >> (8 * i)) & BYTE_MASK;
+
+        auto nibble = (uint8_t)(w >> 24);
+        if (pos % 2 == 0)
+            denseNibble = nibble;
+        else if (base + 6 < limit)
+            dataStore[base + 6] = (uint8_t)(denseNibble | (nibble << 4));
+
+        pos++;
+        return DecoderResult::PARSING_BODY;
+    }
+
+    // Whole pairs strictly before the final one, like the version 1 bulk path
+    size_t readDenseBodyFloats(const float *f, size_t n)
+    {
+        if (pos % 2 != 0 || dataSize < 1)
+            return 0;
+        size_t firstPair = pos / 2;
+        size_t pairs = (dataSize - 1) / 7;
+        size_t roomPairs = dataStoreSize / 7;
+        pairs = roomPairs < pairs ? roomPairs : pairs;
+        if (pairs <= firstPair)
+            return 0;
+        pairs -= firstPair;
+        if (n > 2 * pairs)
+            n = 2 * pairs;
+
+        auto k = activeKernels().validateFloats(f, n, DENSE_MINIMUM_MAGNITUDE,
+                                                DENSE_MAXIMUM_MAGNITUDE, nullptr, 0, nullptr);
+        k -= k % 2;
+
+        decodeFloatsToBytesDense(f, k, dataStore + 7 * firstPair);
+        pos += (uint32_t)k;
+        return k;
+    }
 
     void setState(DecoderState s)
     {
@@ -512,9 +1947,91 @@ struct ProtocolDecoder
     }
 };
 
+#if __cplusplus >= 201703L
+/*
+ * A complete message built at compile time. For fixed messages (handshakes, mode switches
+ * and so on) this gives you exactly the float stream ProtocolEncoder would produce, so
+ * sending one is just a walk over the array:
+ *
+ *     static constexpr tipsy::StaticMessage hello("application/text", "hello");
+ *     for (auto f : hello) ...
+ *
+ * Both the mime type and the data are taken with their full array size, so a string
+ * literal payload is sent with its terminating null, as the tests do with strlen + 1.
+ * This needs C++17 for the constexpr array writes.
+ */
+template <size_t MimeN, size_t DataN> struct StaticMessage
+{
+    static_assert(MimeN <= kMaxMimeTypeSize, "Mime type too large");
+    static_assert(DataN <= kMaxMessageLength, "Message too large");
+
+    // begin x3, version, size and mime sentinels and values, mime, body sentinel, body, end
+    static constexpr size_t kMimeFloats{(MimeN + 2) / 3};
+    static constexpr size_t kBodyFloats{(DataN + 2) / 3};
+    static constexpr size_t kSize{3 + 2 + 2 + 2 + kMimeFloats + 1 + kBodyFloats + 1};
+
+    std::array<float, kSize> floats{};
+
+    constexpr StaticMessage(const char (&mimeType)[MimeN], const char (&data)[DataN])
+    {
+        build(mimeType, data);
+    }
+    constexpr StaticMessage(const char (&mimeType)[MimeN], const unsigned char (&data)[DataN])
+    {
+        build(mimeType, data);
+    }
+
+    constexpr size_t size() const { return kSize; }
+    constexpr const float *data() const { return floats.data(); }
+    constexpr const float *begin() const { return floats.data(); }
+    constexpr const float *end() const { return floats.data() + kSize; }
+    constexpr float operator[](size_t i) const { return floats[i]; }
+
+  private:
+    template <typename T> static constexpr unsigned char byteAt(const T *d, size_t n, size_t i)
+    {
+        return i < n ? (unsigned char)d[i] : 0;
+    }
+
+    template <typename T> constexpr void build(const char *mimeType, const T *data)
+    {
+        size_t p{0};
+        for (int i = 0; i < 3; ++i)
+            floats[p++] = kMessageBeginSentinel;
+
+        floats[p++] = kVersionSentinel;
+        floats[p++] =
+            threeBytesToFloatConstexpr(kVersion24Bit & BYTE_MASK, kVersion24Bit >> 8, 0);
+
+        floats[p++] = kSizeSentinel;
+        floats[p++] = threeBytesToFloatConstexpr(DataN & BYTE_MASK, (DataN >> 8) & BYTE_MASK,
+                                                 (DataN >> 16) & BYTE_MASK);
+
+        floats[p++] = kMimeTypeSentinel;
+        floats[p++] = threeBytesToFloatConstexpr(MimeN & BYTE_MASK, MimeN >> 8, 0);
+        for (size_t i = 0; i < MimeN; i += 3)
+        {
+            floats[p++] = threeBytesToFloatConstexpr(byteAt(mimeType, MimeN, i),
+                                                     byteAt(mimeType, MimeN, i + 1),
+                                                     byteAt(mimeType, MimeN, i + 2));
+        }
+
+        floats[p++] = kBodySentinel;
+        for (size_t i = 0; i < DataN; i += 3)
+        {
+            floats[p++] = threeBytesToFloatConstexpr(byteAt(data, DataN, i),
+                                                     byteAt(data, DataN, i + 1),
+                                                     byteAt(data, DataN, i + 2));
+        }
+        floats[p++] = kEndMessageSentinel;
+    }
+};
+#endif
+
 // convenience shorthands for client code
 using EncoderResult = ProtocolEncoder::EncoderResult;
 using DecoderResult = ProtocolDecoder::DecoderResult;
+using DecoderEvent = ProtocolDecoder::Event;
 
 } // namespace tipsy
 #endif // TIPSY_ENCODER_PROTOCOL_H
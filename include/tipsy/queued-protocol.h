@@ -0,0 +1,213 @@
+#pragma once
+#ifndef TIPSY_ENCODER_QUEUED_PROTOCOL_H
+#define TIPSY_ENCODER_QUEUED_PROTOCOL_H
+/*
+ * A ProtocolEncoder fronted by a bounded single producer / single consumer queue of
+ * messages. One thread (the UI or worker thread, say) enqueues messages without ever
+ * blocking, and the audio thread pulls floats; whenever the current message completes the
+ * next queued message starts on the very next float.
+ *
+ * The queue holds descriptors, not copies, so the mime type and data of a queued message
+ * must stay valid until that message has completed (or been terminated). To find out when
+ * that is, enqueue with a release callback: the audio thread hands each finished message
+ * back through a return queue and the producer runs the callbacks in processReleases (which
+ * enqueueMessage also calls), so payloads can come from a pool and go straight back to it.
+ * Neither side locks or allocates.
+ */
+
+#include "protocol.h"
+
+#include <atomic>
+
+namespace tipsy
+{
+template <size_t Capacity = 16> struct QueuedProtocolEncoder
+{
+    static_assert(Capacity >= 2 && (Capacity & (Capacity - 1)) == 0,
+                  "Queue capacity must be a power of two");
+
+    /*
+     * Called on the producer thread once the encoder is done with a message. how is
+     * MESSAGE_COMPLETE or MESSAGE_TERMINATED.
+     */
+    typedef void (*ReleaseCallback)(void *userData, const char *mimeType,
+                                    const unsigned char *data, EncoderResult how);
+
+    /*
+     * Producer side. Checks the message the same way ProtocolEncoder::initiateMessage does
+     * and returns that error, ERROR_QUEUE_FULL if there is no room or MESSAGE_QUEUED. If
+     * release is set it is called exactly once for a queued message, after it has finished.
+     */
+    TIPSY_NODISCARD
+    EncoderResult enqueueMessage(const char *inMimeType, uint32_t inDataBytes,
+                                 const unsigned char *const inData,
+                                 ReleaseCallback release = nullptr, void *releaseData = nullptr)
+    {
+        auto check = ProtocolEncoder::checkMessage(inMimeType, inDataBytes, inData);
+        if (check != EncoderResult::MESSAGE_INITIATED)
+        {
+            return check;
+        }
+
+        processReleases();
+
+        auto t = tail.load(std::memory_order_relaxed);
+        if (t - head.load(std::memory_order_acquire) == Capacity || t - released == kSlots)
+        {
+            return EncoderResult::ERROR_QUEUE_FULL;
+        }
+        auto &d = ring[t & (kSlots - 1)];
+        d.mimeType = inMimeType;
+        d.dataBytes = inDataBytes;
+        d.data = inData;
+        d.release = release;
+        d.releaseData = releaseData;
+        tail.store(t + 1, std::memory_order_release);
+        return EncoderResult::MESSAGE_QUEUED;
+    }
+
+    /*
+     * Producer side. Runs the release callbacks of every message the audio thread has
+     * finished with since the last call, in order, and returns how many there were.
+     */
+    size_t processReleases()
+    {
+        auto d = done.load(std::memory_order_acquire);
+        auto n = d - released;
+        while (released != d)
+        {
+            auto &m = ring[released & (kSlots - 1)];
+            if (m.release)
+                m.release(m.releaseData, m.mimeType, m.data, m.how);
+            released++;
+        }
+        return n;
+    }
+
+    // Messages waiting behind the current one. Exact on the audio thread, a snapshot elsewhere.
+    size_t queuedMessages() const
+    {
+        return tail.load(std::memory_order_acquire) - head.load(std::memory_order_acquire);
+    }
+
+    /*
+     * Consumer (audio thread) side. Same results as ProtocolEncoder::getNextMessageFloat,
+     * except that a dormant encoder first starts the next queued message, if any.
+     */
+    TIPSY_NODISCARD
+    EncoderResult getNextMessageFloat(float &f)
+    {
+        if (encoder.isDormant())
+        {
+            startNextMessage();
+        }
+        auto r = encoder.getNextMessageFloat(f);
+        if (r == EncoderResult::MESSAGE_COMPLETE)
+        {
+            finishMessage(r);
+        }
+        return r;
+    }
+
+    /*
+     * Block version. Encodes queued messages back to back into out and returns how many
+     * floats were written, which is less than n only if the queue ran dry.
+     */
+    size_t getNextMessageFloats(float *out, size_t n)
+    {
+        size_t w{0};
+        while (w < n)
+        {
+            if (encoder.isDormant() && !startNextMessage())
+            {
+                break;
+            }
+            w += encoder.getNextMessageFloats(out + w, n - w);
+            if (encoder.isDormant())
+            {
+                finishMessage(EncoderResult::MESSAGE_COMPLETE);
+            }
+        }
+        return w;
+    }
+
+    // Consumer side. Abandons the current message; the next queued one starts on the next float
+    TIPSY_NODISCARD
+    EncoderResult terminateCurrentMessage()
+    {
+        auto r = encoder.terminateCurrentMessage();
+        if (r == EncoderResult::MESSAGE_TERMINATED)
+        {
+            finishMessage(r);
+        }
+        return r;
+    }
+
+    // Consumer side. Applies to messages started after the call.
+    bool setEncodingVersion(uint16_t v) { return encoder.setEncodingVersion(v); }
+
+    // Consumer side. True if there is no message in flight and none waiting.
+    bool isDormant() { return encoder.isDormant() && queuedMessages() == 0; }
+
+    bool isError(EncoderResult r) const { return encoder.isError(r); }
+
+  private:
+    bool startNextMessage()
+    {
+        auto h = head.load(std::memory_order_relaxed);
+        if (h == tail.load(std::memory_order_acquire))
+        {
+            return false;
+        }
+        auto &d = ring[h & (kSlots - 1)];
+        head.store(h + 1, std::memory_order_release);
+
+        // enqueueMessage already checked everything initiateMessage can refuse
+        auto r = encoder.initiateMessage(d.mimeType, d.dataBytes, d.data);
+        assert(r == EncoderResult::MESSAGE_INITIATED);
+        (void)r;
+        return true;
+    }
+
+    // Messages finish in the order they start, so the return queue is just the stretch of
+    // the ring between released and done
+    void finishMessage(EncoderResult how)
+    {
+        auto d = done.load(std::memory_order_relaxed);
+        ring[d & (kSlots - 1)].how = how;
+        done.store(d + 1, std::memory_order_release);
+    }
+
+    struct MessageDescriptor
+    {
+        const char *mimeType{nullptr};
+        uint32_t dataBytes{0};
+        const unsigned char *data{nullptr};
+        ReleaseCallback release{nullptr};
+        void *releaseData{nullptr};
+        EncoderResult how{EncoderResult::MESSAGE_COMPLETE};
+    };
+
+    /*
+     * A slot is live from enqueue until its release has run: up to Capacity waiting, one
+     * being encoded and whatever finished since the producer last looked. Twice the queue
+     * depth leaves room for all of that without the return queue ever holding up the audio
+     * thread.
+     */
+    static constexpr size_t kSlots{Capacity * 2};
+
+    ProtocolEncoder encoder;
+
+    MessageDescriptor ring[kSlots];
+
+    // head and done are only written by the consumer, tail and released only by the
+    // producer. Where TIPSY_CACHE_LINE_ALIGNED applies each pair starts a cache line of its
+    // own, which nothing else in the queue shares.
+    TIPSY_CACHE_LINE_ALIGNED std::atomic<size_t> head{0};
+    std::atomic<size_t> done{0};
+    TIPSY_CACHE_LINE_ALIGNED std::atomic<size_t> tail{0};
+    size_t released{0};
+};
+} // namespace tipsy
+
+#endif // TIPSY_ENCODER_QUEUED_PROTOCOL_H
@@ -10,6 +10,12 @@
 
 #include "version.h"
 #include "binary-to-float.h"
+#include "buffer-pool.h"
 #include "protocol.h"
+#include "poly-protocol.h"
+#include "queued-protocol.h"
+#include "chunked-protocol.h"
+#include "priority-protocol.h"
+#include "handoff-protocol.h"
 
 #endif // TIPSY_ENCODER_TIPSY_H
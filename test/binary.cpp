@@ -6,6 +6,8 @@
 #include "catch2.hpp"
 #include "tipsy/binary-to-float.h"
 
+#include <vector>
+
 TEST_CASE("Binary to Float in range across all binaries")
 {
     // This test can be a touch slow but works fine
@@ -104,4 +106,267 @@ TEST_CASE("Constructors and Utilities")
         REQUIRE(f.second() == 23);
         REQUIRE(f.third() == 0);
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Bulk Encode Matches FloatBytes")
+{
+    static constexpr int maxBytes{200};
+    uint8_t data[maxBytes];
+    for (int i = 0; i < maxBytes; ++i)
+        data[i] = (uint8_t)((i * 97 + 13) & 255);
+
+    for (int nBytes = 0; nBytes < maxBytes; ++nBytes)
+    {
+        INFO("nBytes is " << nBytes);
+        float out[maxBytes];
+        auto n = tipsy::encodeBytesToFloats(data, nBytes, out);
+        REQUIRE(n == (size_t)(nBytes + 2) / 3);
+
+        for (int i = 0; i < (int)n; ++i)
+        {
+            uint8_t d[3]{0, 0, 0};
+            for (int k = 0; k < 3 && 3 * i + k < nBytes; ++k)
+                d[k] = data[3 * i + k];
+            auto expected = tipsy::FloatBytes(d[0], d[1], d[2]);
+            REQUIRE(memcmp(&expected.f, &out[i], sizeof(float)) == 0);
+        }
+    }
+
+    SECTION("Scalar Kernel Also Matches")
+    {
+        float a[maxBytes], b[maxBytes];
+        auto na = tipsy::encodeBytesToFloats(data, maxBytes, a);
+        auto nb = tipsy::detail::encodeBytesToFloatsScalar(data, maxBytes, b);
+        REQUIRE(na == nb);
+        REQUIRE(memcmp(a, b, na * sizeof(float)) == 0);
+    }
+}
+
+TEST_CASE("Bulk Decode Inverts Bulk Encode")
+{
+    static constexpr int maxFloats{80};
+    uint8_t data[maxFloats * 3];
+    for (int i = 0; i < maxFloats * 3; ++i)
+        data[i] = (uint8_t)((i * 131 + 7) & 255);
+
+    float enc[maxFloats];
+    auto n = tipsy::encodeBytesToFloats(data, maxFloats * 3, enc);
+    REQUIRE(n == maxFloats);
+
+    for (int nFloats = 0; nFloats <= maxFloats; ++nFloats)
+    {
+        INFO("nFloats is " << nFloats);
+        uint8_t out[maxFloats * 3 + 1];
+        memset(out, 0xAB, sizeof(out));
+        tipsy::decodeFloatsToBytes(enc, nFloats, out);
+        REQUIRE(memcmp(out, data, nFloats * 3) == 0);
+        REQUIRE(out[nFloats * 3] == 0xAB);
+    }
+
+    SECTION("Scalar Kernel Also Matches")
+    {
+        uint8_t a[maxFloats * 3], b[maxFloats * 3];
+        tipsy::decodeFloatsToBytes(enc, maxFloats, a);
+        tipsy::detail::decodeFloatsToBytesScalar(enc, maxFloats, b);
+        REQUIRE(memcmp(a, b, sizeof(a)) == 0);
+    }
+}
+
+TEST_CASE("Every Supported SIMD Level Matches Scalar")
+{
+    static constexpr int maxBytes{400};
+    uint8_t data[maxBytes];
+    for (int i = 0; i < maxBytes; ++i)
+        data[i] = (uint8_t)((i * 53 + 11) & 255);
+
+    auto scalar = tipsy::kernelsForLevel(tipsy::SimdLevel::SCALAR);
+    auto detected = tipsy::detectSimdLevel();
+    REQUIRE(tipsy::activeKernels().level <= detected);
+
+    for (int li = 0; li <= (int)detected; ++li)
+    {
+        auto k = tipsy::kernelsForLevel((tipsy::SimdLevel)li);
+        DYNAMIC_SECTION("Level " << tipsy::simdLevelName((tipsy::SimdLevel)li))
+        {
+            for (int nBytes = 0; nBytes < maxBytes; nBytes += 7)
+            {
+                INFO("nBytes is " << nBytes);
+                float a[maxBytes], b[maxBytes];
+                auto na = k.encodeBytesToFloats(data, nBytes, a);
+                auto nb = scalar.encodeBytesToFloats(data, nBytes, b);
+                REQUIRE(na == nb);
+                REQUIRE(memcmp(a, b, na * sizeof(float)) == 0);
+
+                uint8_t da[maxBytes + 3], db[maxBytes + 3];
+                memset(da, 0xAB, sizeof(da));
+                memset(db, 0xAB, sizeof(db));
+                k.decodeFloatsToBytes(a, na, da);
+                scalar.decodeFloatsToBytes(b, nb, db);
+                REQUIRE(memcmp(da, db, sizeof(da)) == 0);
+                REQUIRE(memcmp(da, data, nBytes) == 0);
+            }
+        }
+    }
+}
+
+TEST_CASE("Every Supported SIMD Level Matches Scalar For Dense")
+{
+    static constexpr int maxBytes{400};
+    uint8_t data[maxBytes];
+    for (int i = 0; i < maxBytes; ++i)
+        data[i] = (uint8_t)((i * 97 + 5) & 255);
+
+    auto scalar = tipsy::kernelsForLevel(tipsy::SimdLevel::SCALAR);
+    auto detected = tipsy::detectSimdLevel();
+
+    for (int li = 0; li <= (int)detected; ++li)
+    {
+        auto k = tipsy::kernelsForLevel((tipsy::SimdLevel)li);
+        DYNAMIC_SECTION("Level " << tipsy::simdLevelName((tipsy::SimdLevel)li))
+        {
+            for (int nBytes = 0; nBytes < maxBytes - 7; nBytes += 3)
+            {
+                INFO("nBytes is " << nBytes);
+                float a[maxBytes], b[maxBytes];
+                auto na = k.encodeBytesToFloatsDense(data, nBytes, a);
+                auto nb = scalar.encodeBytesToFloatsDense(data, nBytes, b);
+                REQUIRE(na == nb);
+                REQUIRE(memcmp(a, b, na * sizeof(float)) == 0);
+
+                uint8_t da[maxBytes + 7], db[maxBytes + 7];
+                memset(da, 0xAB, sizeof(da));
+                memset(db, 0xAB, sizeof(db));
+                k.decodeFloatsToBytesDense(a, na, da);
+                scalar.decodeFloatsToBytesDense(b, nb, db);
+                REQUIRE(memcmp(da, db, sizeof(da)) == 0);
+                REQUIRE(memcmp(da, data, nBytes) == 0);
+            }
+        }
+    }
+}
+
+TEST_CASE("Constexpr Three Bytes To Float Matches FloatBytes")
+{
+    static_assert(tipsy::threeBytesToFloatConstexpr(255, 255, 127) == tipsy::maximumEncodedFloat(),
+                  "constexpr max");
+    static_assert(tipsy::threeBytesToFloatConstexpr(255, 255, 255) == tipsy::minimumEncodedFloat(),
+                  "constexpr min");
+
+    int mismatches{0};
+    for (int i = 0; i < 256; i++)
+        for (int j = 0; j < 256; j++)
+            for (int k = 0; k < 256; k++)
+            {
+                auto a = tipsy::threeBytesToFloatConstexpr(i, j, k);
+                auto b = tipsy::FloatBytes(i, j, k).f;
+                if (memcmp(&a, &b, sizeof(float)) != 0)
+                    mismatches++;
+            }
+    REQUIRE(mismatches == 0);
+}
+
+TEST_CASE("Dense Encoding Round Trips")
+{
+    static constexpr int maxBytes{120};
+    uint8_t data[maxBytes];
+    for (int i = 0; i < maxBytes; ++i)
+        data[i] = (uint8_t)((i * 89 + 41) & 255);
+
+    for (int nBytes = 0; nBytes < maxBytes; ++nBytes)
+    {
+        INFO("nBytes is " << nBytes);
+        float enc[maxBytes];
+        auto n = tipsy::encodeBytesToFloatsDense(data, nBytes, enc);
+        REQUIRE(n == (size_t)2 * ((nBytes + 6) / 7));
+
+        uint8_t dec[maxBytes + 7];
+        tipsy::decodeFloatsToBytesDense(enc, n, dec);
+        REQUIRE(memcmp(dec, data, nBytes) == 0);
+        for (size_t i = nBytes; i < n / 2 * 7; ++i)
+            REQUIRE(dec[i] == 0);
+    }
+}
+
+TEST_CASE("Dense Encoding Stays In Range")
+{
+    // Every exponent nibble and sign, with a spread of mantissas including the extremes
+    for (uint32_t nibble = 0; nibble < 16; ++nibble)
+    {
+        for (uint32_t low : {0u, 1u, 0x123456u, 0x7fffffu, 0x800000u, 0xabcdefu, 0xffffffu})
+        {
+            auto w = low | (nibble << 24);
+            auto f = tipsy::denseWordToFloat(w);
+            INFO("Word " << std::hex << w << " float " << f);
+            REQUIRE(tipsy::denseFloatToWord(f) == w);
+            REQUIRE(std::isnormal(f));
+            REQUIRE(f > -2);
+            REQUIRE(f < 2);
+            REQUIRE(tipsy::isValidDenseDataEncoding(f));
+        }
+    }
+
+    REQUIRE(tipsy::denseWordToFloat(0) == tipsy::DENSE_MINIMUM_MAGNITUDE);
+    REQUIRE(tipsy::denseWordToFloat(0x0f7fffff) == tipsy::DENSE_MAXIMUM_MAGNITUDE);
+    REQUIRE(!tipsy::isValidDenseDataEncoding(0.f));
+    REQUIRE(!tipsy::isValidDenseDataEncoding(2.f));
+    REQUIRE(!tipsy::isValidDenseDataEncoding(-2.f));
+
+    // v1 floats, which carry the header of a dense message, are valid dense floats too
+    REQUIRE(tipsy::isValidDenseDataEncoding(tipsy::minimumEncodedFloat()));
+    REQUIRE(tipsy::isValidDenseDataEncoding(tipsy::maximumEncodedFloat()));
+    REQUIRE(tipsy::isValidDenseDataEncoding(tipsy::FloatBytes()));
+}
+
+TEST_CASE("Strided And Indexed Kernels")
+{
+    static constexpr int nBytes{500};
+    static constexpr int nFloats{(nBytes + 2) / 3};
+    uint8_t data[nBytes];
+    for (int i = 0; i < nBytes; ++i)
+        data[i] = (uint8_t)((i * 71 + 29) & 255);
+
+    float contiguous[nFloats];
+    REQUIRE(tipsy::encodeBytesToFloats(data, nBytes, contiguous) == nFloats);
+
+    SECTION("Strided")
+    {
+        for (size_t stride : {1, 2, 5, 16})
+        {
+            INFO("Stride " << stride);
+            std::vector<float> strided(nFloats * stride, 7.f);
+            REQUIRE(tipsy::encodeBytesToFloatsStrided(data, nBytes, strided.data(), stride) ==
+                    nFloats);
+            for (size_t i = 0; i < strided.size(); ++i)
+            {
+                if (i % stride == 0)
+                    REQUIRE(memcmp(&strided[i], &contiguous[i / stride], sizeof(float)) == 0);
+                else
+                    REQUIRE(strided[i] == 7.f);
+            }
+
+            uint8_t out[nFloats * 3];
+            tipsy::decodeFloatsToBytesStrided(strided.data(), stride, nFloats, out);
+            REQUIRE(memcmp(out, data, nBytes) == 0);
+        }
+    }
+
+    SECTION("Indexed")
+    {
+        // reverse order and spread over a buffer twice the size
+        uint32_t index[nFloats];
+        for (int i = 0; i < nFloats; ++i)
+            index[i] = 2 * (nFloats - 1 - i);
+
+        std::vector<float> scattered(2 * nFloats, 7.f);
+        REQUIRE(tipsy::encodeBytesToFloatsIndexed(data, nBytes, scattered.data(), index) ==
+                nFloats);
+        for (int i = 0; i < nFloats; ++i)
+        {
+            REQUIRE(memcmp(&scattered[index[i]], &contiguous[i], sizeof(float)) == 0);
+            REQUIRE(scattered[index[i] + 1] == 7.f);
+        }
+
+        uint8_t out[nFloats * 3];
+        tipsy::decodeFloatsToBytesIndexed(scattered.data(), index, nFloats, out);
+        REQUIRE(memcmp(out, data, nBytes) == 0);
+    }
+}
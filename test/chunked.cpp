@@ -0,0 +1,243 @@
+/*
+ * Test chunked messages made of continuation frames
+ */
+
+#include "catch2.hpp"
+#include "tipsy/tipsy.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+namespace
+{
+std::vector<float> encodeAll(tipsy::ChunkedProtocolEncoder &ce, size_t block)
+{
+    std::vector<float> res, buf(block);
+    while (!ce.isDormant())
+    {
+        if (block == 1)
+        {
+            float f;
+            auto r = ce.getNextMessageFloat(f);
+            REQUIRE(!ce.isError(r));
+            res.push_back(f);
+        }
+        else
+        {
+            auto w = ce.getNextMessageFloats(buf.data(), block);
+            res.insert(res.end(), buf.begin(), buf.begin() + w);
+        }
+    }
+    return res;
+}
+} // namespace
+
+TEST_CASE("Chunked Message Round Trip")
+{
+    static constexpr uint32_t bs{10000};
+    std::vector<unsigned char> inB(bs), outB(bs + 1);
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 31 + 5);
+    const char *mt{"application/x-sample-library"};
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        for (uint32_t chunk : {1u, 7u, 1000u, 3333u, bs, bs * 2})
+        {
+            for (uint32_t sz : {0u, 1u, 999u, 1000u, 1001u, bs})
+            {
+                for (size_t block : {1, 64})
+                {
+                    INFO("Version " << version << " chunk " << chunk << " size " << sz
+                                    << " block " << block);
+                    if (chunk == 1 && sz > 1000)
+                        continue;
+
+                    tipsy::ChunkedProtocolEncoder ce;
+                    REQUIRE(ce.setEncodingVersion(version));
+                    REQUIRE(ce.setChunkSize(chunk));
+                    REQUIRE(ce.initiateMessage(mt, sz, inB.data()) ==
+                            tipsy::EncoderResult::MESSAGE_INITIATED);
+                    auto stream = encodeAll(ce, block);
+
+                    std::fill(outB.begin(), outB.end(), 0);
+                    tipsy::ChunkedProtocolDecoder cd;
+                    cd.provideDataBuffer(outB.data(), (uint32_t)outB.size());
+                    int headers{0}, bodies{0};
+                    for (auto f : stream)
+                    {
+                        auto r = cd.readFloat(f);
+                        REQUIRE(!cd.isError(r));
+                        if (r == tipsy::DecoderResult::HEADER_READY)
+                        {
+                            headers++;
+                            REQUIRE(std::string(cd.getMimeType()) == mt);
+                            REQUIRE(cd.getDataSize() == sz);
+                        }
+                        if (r == tipsy::DecoderResult::BODY_READY)
+                            bodies++;
+                    }
+                    REQUIRE(headers == 1);
+                    REQUIRE(bodies == 1);
+                    REQUIRE(cd.isChunked());
+                    REQUIRE(cd.getReceivedBytes() == sz);
+                    REQUIRE(memcmp(outB.data(), inB.data(), sz) == 0);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Chunked Message Larger Than One Frame Can Carry")
+{
+    uint32_t bs = tipsy::kMaxMessageLength + 123457;
+    std::vector<unsigned char> inB(bs), outB(bs + 1);
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)((i >> 8) ^ i);
+
+    tipsy::ProtocolEncoder single;
+    REQUIRE(single.initiateMessage("a", bs, inB.data()) ==
+            tipsy::EncoderResult::ERROR_MESSAGE_TOO_LARGE);
+
+    tipsy::ChunkedProtocolEncoder ce;
+    REQUIRE(ce.setEncodingVersion(tipsy::kVersion28Bit));
+    REQUIRE(ce.initiateMessage("a", bs, inB.data()) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    auto stream = encodeAll(ce, 4096);
+
+    tipsy::ChunkedProtocolDecoder cd;
+    cd.provideDataBuffer(outB.data(), (uint32_t)outB.size());
+    int bodies{0};
+    for (auto f : stream)
+    {
+        auto r = cd.readFloat(f);
+        REQUIRE(!cd.isError(r));
+        if (r == tipsy::DecoderResult::BODY_READY)
+            bodies++;
+    }
+    REQUIRE(bodies == 1);
+    REQUIRE(cd.getDataSize() == bs);
+    REQUIRE(memcmp(outB.data(), inB.data(), bs) == 0);
+}
+
+TEST_CASE("Chunked Decoder Errors")
+{
+    static constexpr uint32_t bs{300};
+    unsigned char inB[bs], outB[bs + 1];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)i;
+
+    tipsy::ChunkedProtocolEncoder ce;
+    REQUIRE(ce.setChunkSize(100));
+    REQUIRE(ce.initiateMessage("a", bs, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    REQUIRE(!ce.setChunkSize(10));
+    auto stream = encodeAll(ce, 64);
+
+    // Find where the second frame starts and drop it
+    size_t frameStarts[3]{0, 0, 0};
+    int k{0};
+    for (size_t i = 0; i + 2 < stream.size() && k < 3; ++i)
+        if (stream[i] == tipsy::kMessageBeginSentinel && stream[i + 1] == stream[i] &&
+            stream[i + 2] == stream[i] && (i == 0 || stream[i - 1] != stream[i]))
+            frameStarts[k++] = i;
+    REQUIRE(k == 3);
+
+    SECTION("Missing Frame")
+    {
+        tipsy::ChunkedProtocolDecoder cd;
+        cd.provideDataBuffer(outB, sizeof(outB));
+        bool sawError{false};
+        for (size_t i = 0; i < stream.size(); ++i)
+        {
+            if (i >= frameStarts[1] && i < frameStarts[2])
+                continue;
+            auto r = cd.readFloat(stream[i]);
+            REQUIRE(r != tipsy::DecoderResult::BODY_READY);
+            if (r == tipsy::DecoderResult::ERROR_CHUNK_OUT_OF_SEQUENCE)
+                sawError = true;
+        }
+        REQUIRE(sawError);
+    }
+
+    SECTION("Dropped Float")
+    {
+        // the second frame loses one body float but still ends on its end sentinel
+        size_t dropped{0};
+        for (size_t i = frameStarts[1]; i < frameStarts[2]; ++i)
+            if (stream[i] == tipsy::kBodySentinel)
+                dropped = i + 5;
+        REQUIRE(dropped > 0);
+
+        tipsy::ChunkedProtocolDecoder cd;
+        cd.provideDataBuffer(outB, sizeof(outB));
+        bool sawError{false};
+        for (size_t i = 0; i < stream.size(); ++i)
+        {
+            if (i == dropped)
+                continue;
+            auto r = cd.readFloat(stream[i]);
+            REQUIRE(r != tipsy::DecoderResult::BODY_READY);
+            if (r == tipsy::DecoderResult::ERROR_CHUNK_OUT_OF_SEQUENCE)
+                sawError = true;
+        }
+        REQUIRE(sawError);
+        REQUIRE(cd.getReceivedBytes() < bs);
+    }
+
+    SECTION("Failed Frame")
+    {
+        // the second frame claims more than the buffer holds, so fails part way through
+        auto broken = stream;
+        size_t sizeAt{0};
+        for (size_t i = frameStarts[1]; i < frameStarts[2] && !sizeAt; ++i)
+            if (broken[i] == tipsy::kSizeSentinel)
+                sizeAt = i + 1;
+        REQUIRE(sizeAt > 0);
+        broken[sizeAt] = tipsy::threeBytesToFloat(0xFF, 0xFF, 0x0F);
+
+        tipsy::ChunkedProtocolDecoder cd;
+        cd.provideDataBuffer(outB, sizeof(outB));
+        bool sawError{false};
+        for (auto f : broken)
+        {
+            auto r = cd.readFloat(f);
+            REQUIRE(r != tipsy::DecoderResult::BODY_READY);
+            if (r == tipsy::DecoderResult::ERROR_DATA_TOO_LARGE)
+                sawError = true;
+        }
+        REQUIRE(sawError);
+    }
+
+    SECTION("Buffer Too Small")
+    {
+        tipsy::ChunkedProtocolDecoder cd;
+        cd.provideDataBuffer(outB, bs);
+        bool sawError{false};
+        for (size_t i = 0; i < frameStarts[1]; ++i)
+        {
+            auto r = cd.readFloat(stream[i]);
+            if (r == tipsy::DecoderResult::ERROR_DATA_TOO_LARGE)
+                sawError = true;
+        }
+        REQUIRE(sawError);
+    }
+
+    SECTION("Plain Messages Pass Through")
+    {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateMessage("b", 5, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        tipsy::ChunkedProtocolDecoder cd;
+        cd.provideDataBuffer(outB, sizeof(outB));
+        bool gotBody{false};
+        float f;
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            if (cd.readFloat(f) == tipsy::DecoderResult::BODY_READY)
+                gotBody = true;
+        }
+        REQUIRE(gotBody);
+        REQUIRE(!cd.isChunked());
+        REQUIRE(cd.getDataSize() == 5);
+    }
+}
@@ -0,0 +1,194 @@
+/*
+ * Test the handoff decoder
+ */
+
+#include "catch2.hpp"
+#include "tipsy/tipsy.h"
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+namespace
+{
+std::vector<float> encode(const std::string &m, const char *mimeType = "text/plain")
+{
+    tipsy::ProtocolEncoder pe;
+    std::vector<float> res;
+    auto r = pe.initiateMessage(mimeType, (uint32_t)m.size(), (const unsigned char *)m.data());
+    REQUIRE(r == tipsy::EncoderResult::MESSAGE_INITIATED);
+    float f;
+    while (pe.getNextMessageFloat(f) != tipsy::EncoderResult::DORMANT)
+        res.push_back(f);
+    return res;
+}
+} // namespace
+
+TEST_CASE("Handoff Decoder Rotates Buffers")
+{
+    unsigned char storage[4 * 64];
+    tipsy::HandoffProtocolDecoder<4> hd;
+    REQUIRE(hd.provideDataBuffers(storage, 64));
+
+    std::vector<std::string> msgs{"zero", "one", "two", "three"};
+    for (auto &m : msgs)
+    {
+        for (auto f : encode(m))
+            REQUIRE(!hd.isError(hd.readFloat(f)));
+    }
+    REQUIRE(hd.pending() == 4);
+
+    // Every buffer is waiting on the consumer, so the next message has nowhere to go
+    bool refused{false};
+    for (auto f : encode("four"))
+        refused = refused || hd.readFloat(f) == tipsy::DecoderResult::ERROR_NO_BUFFER_AVAILABLE;
+    REQUIRE(refused);
+    REQUIRE(hd.pending() == 4);
+
+    for (size_t i = 0; i < msgs.size(); ++i)
+    {
+        auto *m = hd.front();
+        REQUIRE(m);
+        REQUIRE(std::string(m->mimeType) == "text/plain");
+        REQUIRE(std::string((const char *)m->data, m->dataSize) == msgs[i]);
+        REQUIRE(m->data == storage + i * 64);
+        hd.pop();
+    }
+    REQUIRE(!hd.front());
+
+    // With a buffer back the decoder picks up again at the next message
+    for (auto f : encode("five"))
+        REQUIRE(!hd.isError(hd.readFloat(f)));
+    REQUIRE(hd.pending() == 1);
+    REQUIRE(std::string((const char *)hd.front()->data, hd.front()->dataSize) == "five");
+    REQUIRE(hd.front()->data == storage);
+}
+
+TEST_CASE("Handoff Decoder Skips Broken Messages")
+{
+    unsigned char storage[2 * 16];
+    tipsy::HandoffProtocolDecoder<2> hd;
+    REQUIRE(hd.provideDataBuffers(storage, 16));
+
+    // too big for a buffer
+    for (auto f : encode("this message is far too long"))
+        (void)hd.readFloat(f);
+    REQUIRE(hd.pending() == 0);
+
+    // cut off half way through its body by the next message
+    auto cut = encode("interrupted");
+    cut.resize(cut.size() - 3);
+    for (auto f : cut)
+        (void)hd.readFloat(f);
+    for (auto f : encode("whole"))
+        REQUIRE(!hd.isError(hd.readFloat(f)));
+
+    REQUIRE(hd.pending() == 1);
+    REQUIRE(std::string((const char *)hd.front()->data, hd.front()->dataSize) == "whole");
+}
+
+TEST_CASE("Handoff Decoder Reports Resyncs While Starved")
+{
+    unsigned char storage[2 * 16];
+    tipsy::HandoffProtocolDecoder<2> hd;
+    REQUIRE(hd.provideDataBuffers(storage, 16));
+    for (auto m : {"zero", "one"})
+    {
+        for (auto f : encode(m))
+            REQUIRE(!hd.isError(hd.readFloat(f)));
+    }
+    REQUIRE(hd.pending() == 2);
+
+    // with every buffer held, resync through junk to a message which has nowhere to go
+    hd.resync();
+    REQUIRE(hd.isResyncing());
+    std::vector<float> stream{0.7f, tipsy::kMessageBeginSentinel, 0.2f, 0.9f};
+    auto m = encode("two");
+    stream.insert(stream.end(), m.begin(), m.end());
+
+    tipsy::DecoderEvent events[8];
+    auto ne = hd.readFloats(stream.data(), stream.size(), events, 8);
+    REQUIRE(ne >= 2);
+    REQUIRE(events[0].result == tipsy::DecoderResult::RESYNCED);
+    REQUIRE(events[0].offset == 6);
+    REQUIRE(hd.getDiscardedFloats() == 4);
+    REQUIRE(!hd.isResyncing());
+    REQUIRE(events[1].result == tipsy::DecoderResult::ERROR_NO_BUFFER_AVAILABLE);
+    REQUIRE(hd.pending() == 2);
+}
+
+TEST_CASE("Handoff Decoder Feeds A Consumer Thread")
+{
+    static constexpr int nMessages{500};
+    static constexpr uint32_t bufferSize{256};
+    unsigned char storage[4 * bufferSize];
+    tipsy::HandoffProtocolDecoder<4> hd;
+    REQUIRE(hd.provideDataBuffers(storage, bufferSize));
+
+    std::vector<float> stream;
+    for (int i = 0; i < nMessages; ++i)
+    {
+        auto s = encode("message " + std::to_string(i) + std::string(i % 100, '.'));
+        stream.insert(stream.end(), s.begin(), s.end());
+        // some idle cable between messages gives the consumer time to catch up
+        stream.insert(stream.end(), 50, 0.f);
+    }
+
+    std::atomic<bool> done{false};
+    std::vector<std::string> received;
+    std::thread consumer([&]() {
+        while (!done || hd.front())
+        {
+            auto *m = hd.front();
+            if (!m)
+            {
+                std::this_thread::yield();
+                continue;
+            }
+            received.emplace_back((const char *)m->data, m->dataSize);
+            hd.pop();
+        }
+    });
+
+    size_t refused{0};
+    tipsy::DecoderEvent events[8];
+    for (size_t i = 0; i < stream.size(); i += 64)
+    {
+        auto n = std::min((size_t)64, stream.size() - i);
+        size_t consumed{0};
+        while (consumed < n)
+        {
+            auto ne = hd.readFloats(stream.data() + i + consumed, n - consumed, events, 8);
+            if (ne == 0)
+                break;
+            for (size_t e = 0; e < ne; ++e)
+            {
+                if (events[e].result == tipsy::DecoderResult::ERROR_NO_BUFFER_AVAILABLE)
+                    refused++;
+                else
+                    REQUIRE(!hd.isError(events[e].result));
+            }
+            consumed += events[ne - 1].offset + 1;
+            if (ne < 8 && events[ne - 1].result != tipsy::DecoderResult::BODY_READY)
+                break;
+        }
+        std::this_thread::yield();
+    }
+    done = true;
+    consumer.join();
+
+    // A message may be refused if the consumer falls behind, but never mangled
+    REQUIRE(received.size() + refused >= (size_t)nMessages);
+    REQUIRE(received.size() > 0);
+    size_t last{0};
+    for (auto &r : received)
+    {
+        REQUIRE(r.substr(0, 8) == "message ");
+        auto idx = (size_t)std::stoi(r.substr(8));
+        REQUIRE((idx >= last));
+        REQUIRE(r.size() == std::string("message " + std::to_string(idx)).size() + idx % 100);
+        last = idx;
+    }
+}
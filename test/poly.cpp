@@ -0,0 +1,126 @@
+/*
+ * Test the polyphonic striped protocol
+ */
+
+#include "catch2.hpp"
+#include "tipsy/tipsy.h"
+
+#include <cstring>
+#include <vector>
+
+TEST_CASE("Poly Encode Decode Across Lane Counts")
+{
+    static constexpr int dataSz{2000};
+    const char *mimeType{"application/octet-stream"};
+
+    unsigned char inB[dataSz], outB[dataSz + 1];
+    for (int j = 0; j < dataSz; ++j)
+        inB[j] = (unsigned char)((j * 17 + 3) & 255);
+
+    // How many floats the single lane encoder needs, so we can check the striping pays off
+    size_t monoFloats{0};
+    {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateMessage(mimeType, dataSz, inB) ==
+                tipsy::EncoderResult::MESSAGE_INITIATED);
+        float nf;
+        while (pe.getNextMessageFloat(nf) != tipsy::EncoderResult::MESSAGE_COMPLETE)
+            monoFloats++;
+        monoFloats++;
+    }
+
+    for (int lanes = 1; lanes <= tipsy::kMaxPolyLanes; ++lanes)
+    {
+        DYNAMIC_SECTION("Lanes " << lanes)
+        {
+            memset(outB, 0, sizeof(outB));
+
+            tipsy::PolyProtocolEncoder pe;
+            REQUIRE(pe.setLanes(lanes));
+            REQUIRE(pe.getLanes() == lanes);
+            REQUIRE(pe.initiateMessage(mimeType, dataSz, inB) ==
+                    tipsy::EncoderResult::MESSAGE_INITIATED);
+
+            tipsy::PolyProtocolDecoder pd;
+            pd.provideDataBuffer(outB, sizeof(outB));
+
+            bool gotHeader{false}, gotBody{false}, encoderDone{false};
+            size_t samples{0};
+            for (int s = 0; s < 10000 && !gotBody; ++s)
+            {
+                float sample[tipsy::kMaxPolyLanes];
+                auto er = pe.getNextMessageSample(sample);
+                REQUIRE(!pe.isError(er));
+                if (!encoderDone)
+                    samples++;
+                if (er == tipsy::EncoderResult::MESSAGE_COMPLETE)
+                    encoderDone = true;
+
+                auto dr = pd.readSample(sample, lanes);
+                REQUIRE(!tipsy::PolyProtocolDecoder::isError(dr));
+                if (dr == tipsy::DecoderResult::HEADER_READY)
+                    gotHeader = true;
+                if (dr == tipsy::DecoderResult::BODY_READY)
+                {
+                    REQUIRE(std::string(pd.getMimeType()) == mimeType);
+                    REQUIRE(pd.getDataSize() == dataSz);
+                    REQUIRE(memcmp(inB, outB, dataSz) == 0);
+                    gotBody = true;
+                }
+            }
+            REQUIRE(gotHeader);
+            REQUIRE(gotBody);
+            REQUIRE(encoderDone);
+            REQUIRE(samples == (monoFloats + lanes - 1) / lanes);
+            REQUIRE(pe.isDormant());
+        }
+    }
+}
+
+TEST_CASE("Poly Back To Back Messages")
+{
+    const char *msgs[]{"first message", "a second, somewhat longer message than the first", "3"};
+
+    tipsy::PolyProtocolEncoder pe;
+    REQUIRE(pe.setLanes(5));
+
+    unsigned char outB[256];
+    tipsy::PolyProtocolDecoder pd;
+    pd.provideDataBuffer(outB, sizeof(outB));
+
+    for (auto m : msgs)
+    {
+        REQUIRE(pe.initiateMessage("text/plain", strlen(m) + 1, (const unsigned char *)m) ==
+                tipsy::EncoderResult::MESSAGE_INITIATED);
+        bool gotBody{false};
+        for (int s = 0; s < 100 && !gotBody; ++s)
+        {
+            float sample[tipsy::kMaxPolyLanes];
+            auto er = pe.getNextMessageSample(sample);
+            REQUIRE(!pe.isError(er));
+            auto dr = pd.readSample(sample, pe.getLanes());
+            REQUIRE(!tipsy::PolyProtocolDecoder::isError(dr));
+            if (dr == tipsy::DecoderResult::BODY_READY)
+            {
+                REQUIRE(std::string((const char *)outB) == m);
+                gotBody = true;
+            }
+        }
+        REQUIRE(gotBody);
+        REQUIRE(pe.isDormant());
+    }
+}
+
+TEST_CASE("Poly Lane Count Limits")
+{
+    tipsy::PolyProtocolEncoder pe;
+    REQUIRE(!pe.setLanes(0));
+    REQUIRE(!pe.setLanes(tipsy::kMaxPolyLanes + 1));
+    REQUIRE(pe.setLanes(4));
+
+    const char *m{"hello"};
+    REQUIRE(pe.initiateMessage("text/plain", strlen(m) + 1, (const unsigned char *)m) ==
+            tipsy::EncoderResult::MESSAGE_INITIATED);
+    REQUIRE(!pe.setLanes(8));
+    REQUIRE(pe.getLanes() == 4);
+}
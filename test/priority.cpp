@@ -0,0 +1,212 @@
+/*
+ * Test urgent messages preempting a bulk body
+ */
+
+#include "catch2.hpp"
+#include "tipsy/tipsy.h"
+
+#include <cstring>
+#include <string>
+#include <vector>
+
+TEST_CASE("Urgent Messages Preempt A Bulk Body")
+{
+    static constexpr uint32_t bs{5000}, us{40};
+    std::vector<unsigned char> inB(bs), outB(bs + 1), urgentB(us + 1);
+    unsigned char clock[us];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 17 + 3);
+    for (uint32_t i = 0; i < us; ++i)
+        clock[i] = (unsigned char)(255 - i);
+    const char *bulkMt{"application/x-sample"};
+    const char *urgentMt{"application/x-clock"};
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        for (size_t every : {40, 97, 1000})
+        {
+            for (size_t block : {1, 16, 256})
+            {
+                for (bool bulkRead : {false, true})
+                {
+                    INFO("Version " << version << " every " << every << " block " << block
+                                    << " bulk read " << bulkRead);
+                    tipsy::PriorityProtocolEncoder pe;
+                    REQUIRE(pe.setEncodingVersion(version));
+                    REQUIRE(pe.initiateMessage(bulkMt, bs, inB.data()) ==
+                            tipsy::EncoderResult::MESSAGE_INITIATED);
+
+                    tipsy::ProtocolDecoder pd;
+                    tipsy::ProtocolDecoder::UrgentState urgentState;
+                    pd.provideDataBuffer(outB.data(), (uint32_t)outB.size());
+                    REQUIRE(pd.provideUrgentDataBuffer(urgentB.data(), (uint32_t)urgentB.size(),
+                                                       &urgentState));
+
+                    std::vector<float> buf(block);
+                    size_t sent{0}, urgentSent{0}, urgentGot{0}, bulkGot{0}, urgentStart{0};
+                    while (!pe.isDormant())
+                    {
+                        if (pe.isUrgentDormant() &&
+                            (urgentSent == 0 || sent >= urgentStart + every))
+                        {
+                            auto sz = (uint32_t)(urgentSent % us);
+                            REQUIRE(pe.initiateUrgentMessage(urgentMt, sz, clock) ==
+                                    tipsy::EncoderResult::MESSAGE_INITIATED);
+                            urgentSent++;
+                            urgentStart = sent;
+                        }
+                        auto n = pe.getNextMessageFloats(buf.data(), block);
+                        sent += n;
+
+                        size_t i{0};
+                        while (i < n)
+                        {
+                            if (bulkRead)
+                            {
+                                i += pd.readBodyFloats(buf.data() + i, n - i);
+                                if (i == n)
+                                    break;
+                            }
+                            auto r = pd.readFloat(buf[i++]);
+                            REQUIRE(!tipsy::ProtocolDecoder::isError(r));
+                            if (r != tipsy::DecoderResult::BODY_READY)
+                                continue;
+                            if (pd.isUrgentMessage())
+                            {
+                                REQUIRE(std::string(pd.getMimeType()) == urgentMt);
+                                REQUIRE(pd.getDataSize() == urgentGot % us);
+                                REQUIRE(memcmp(urgentB.data(), clock, pd.getDataSize()) == 0);
+                                // a header's worth of waiting at most, plus itself
+                                REQUIRE(sent - n + i - urgentStart < 150 + block);
+                                urgentGot++;
+                            }
+                            else
+                            {
+                                REQUIRE(std::string(pd.getMimeType()) == bulkMt);
+                                REQUIRE(pd.getDataSize() == bs);
+                                REQUIRE(pd.getVersion() == version);
+                                bulkGot++;
+                            }
+                        }
+                    }
+                    REQUIRE(bulkGot == 1);
+                    REQUIRE(urgentGot == urgentSent);
+                    REQUIRE(!pd.hasSuspendedMessage());
+                    REQUIRE(memcmp(outB.data(), inB.data(), bs) == 0);
+                    if (every < 1000)
+                        REQUIRE(urgentSent > 5);
+                }
+            }
+        }
+    }
+}
+
+TEST_CASE("Preemption Edge Cases")
+{
+    unsigned char inB[64], outB[65], urgentB[8];
+    tipsy::ProtocolDecoder::UrgentState urgentState;
+    for (int i = 0; i < 64; ++i)
+        inB[i] = (unsigned char)i;
+
+    auto stream = [](tipsy::ProtocolEncoder &pe) {
+        std::vector<float> res;
+        float f;
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            res.push_back(f);
+        }
+        return res;
+    };
+
+    tipsy::ProtocolEncoder bulk, urgent, plain;
+    REQUIRE(urgent.setPreempting(true));
+    REQUIRE(bulk.initiateMessage("a", 60, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    auto b = stream(bulk);
+    REQUIRE(urgent.initiateMessage("u", 4, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    auto u = stream(urgent);
+    REQUIRE(plain.initiateMessage("p", 5, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    auto p = stream(plain);
+
+    auto cut = b.begin() + 15;
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(outB, sizeof(outB));
+
+    SECTION("No Urgent Buffer")
+    {
+        REQUIRE(!pd.provideUrgentDataBuffer(urgentB, sizeof(urgentB), nullptr));
+        bool sawError{false};
+        for (auto f : u)
+            sawError = sawError || pd.readFloat(f) == tipsy::DecoderResult::ERROR_DATA_TOO_LARGE;
+        REQUIRE(sawError);
+    }
+
+    SECTION("A Plain Message Abandons The Body")
+    {
+        REQUIRE(pd.provideUrgentDataBuffer(urgentB, sizeof(urgentB), &urgentState));
+        std::vector<float> s(b.begin(), cut);
+        s.insert(s.end(), p.begin(), p.end());
+        int bodies{0};
+        for (auto f : s)
+        {
+            auto r = pd.readFloat(f);
+            REQUIRE(!tipsy::ProtocolDecoder::isError(r));
+            bodies += r == tipsy::DecoderResult::BODY_READY;
+        }
+        REQUIRE(bodies == 1);
+        REQUIRE(std::string(pd.getMimeType()) == "p");
+        REQUIRE(!pd.hasSuspendedMessage());
+        REQUIRE(memcmp(outB, inB, 5) == 0);
+    }
+
+    SECTION("Pool Buffer Of A Suspended Body")
+    {
+        tipsy::BufferPool pool{{1024, 1}};
+        std::vector<float> s(b.begin(), cut);
+        s.insert(s.end(), u.begin(), u.begin() + u.size() / 2);
+        {
+            tipsy::ProtocolDecoder pooled;
+            REQUIRE(pooled.provideBufferPool(&pool));
+            REQUIRE(pooled.provideUrgentDataBuffer(urgentB, sizeof(urgentB), &urgentState));
+            for (auto f : s)
+                REQUIRE(!tipsy::ProtocolDecoder::isError(pooled.readFloat(f)));
+            REQUIRE(pooled.hasSuspendedMessage());
+            REQUIRE(pool.available(0) == 0);
+        }
+        // destroyed mid urgent message, the interrupted body's buffer still goes back
+        REQUIRE(pool.available(0) == 1);
+    }
+
+    SECTION("Back To Back Urgent Messages")
+    {
+        REQUIRE(pd.provideUrgentDataBuffer(urgentB, sizeof(urgentB), &urgentState));
+        std::vector<float> s(b.begin(), cut);
+        s.insert(s.end(), u.begin(), u.end());
+        s.insert(s.end(), u.begin(), u.end());
+        s.insert(s.end(), cut, b.end());
+        int urgents{0}, bulks{0};
+        for (auto f : s)
+        {
+            auto r = pd.readFloat(f);
+            REQUIRE(!tipsy::ProtocolDecoder::isError(r));
+            if (r == tipsy::DecoderResult::BODY_READY)
+            {
+                if (pd.isUrgentMessage())
+                {
+                    REQUIRE(pd.hasSuspendedMessage());
+                    REQUIRE(std::string(pd.getMimeType()) == "u");
+                    urgents++;
+                }
+                else
+                {
+                    REQUIRE(std::string(pd.getMimeType()) == "a");
+                    bulks++;
+                }
+            }
+        }
+        REQUIRE(urgents == 2);
+        REQUIRE(bulks == 1);
+        REQUIRE(memcmp(outB, inB, 60) == 0);
+        REQUIRE(memcmp(urgentB, inB, 4) == 0);
+    }
+}
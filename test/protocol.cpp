@@ -5,8 +5,12 @@
 #include "catch2.hpp"
 #include "tipsy/tipsy.h"
 
+#include <algorithm>
 #include <cstring>
 #include <iostream>
+#include <limits>
+#include <utility>
+#include <vector>
 
 TEST_CASE("Sentinels In Bound")
 {
@@ -317,6 +321,61 @@ TEST_CASE("Mime Type Size 0 - 20")
     }
 }
 
+TEST_CASE("Mime Types Past The Inline Storage")
+{
+    const char *message{"long names"};
+    unsigned char buffer[64];
+    char mimeBuffer[tipsy::kMaxMimeTypeSize];
+
+    // the last result worth noting, and the mime type at HEADER_READY
+    auto decode = [&](tipsy::ProtocolDecoder &pd, const std::string &mt, std::string &got) {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateMessage(mt.c_str(), strlen(message) + 1,
+                                   (const unsigned char *)message) ==
+                tipsy::EncoderResult::MESSAGE_INITIATED);
+        auto res = tipsy::DecoderResult::DORMANT;
+        float f;
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            auto r = pd.readFloat(f);
+            if (r == tipsy::DecoderResult::HEADER_READY)
+                got = pd.getMimeType();
+            if (!tipsy::ProtocolDecoder::isError(res) &&
+                (r == tipsy::DecoderResult::BODY_READY || tipsy::ProtocolDecoder::isError(r)))
+                res = r;
+        }
+        return res;
+    };
+
+    auto fits = std::string("application/x-") + std::string(15, 'f');
+    auto over = fits + "g";
+    auto longest = std::string(254, 'm');
+    REQUIRE(fits.size() == 29);
+
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(buffer, sizeof(buffer));
+    std::string got;
+    REQUIRE(decode(pd, fits, got) == tipsy::DecoderResult::BODY_READY);
+    REQUIRE(got == fits);
+    REQUIRE(decode(pd, over, got) == tipsy::DecoderResult::ERROR_DATA_TOO_LARGE);
+
+    REQUIRE(pd.provideMimeTypeBuffer(mimeBuffer));
+    REQUIRE(std::string(pd.getMimeType()).empty());
+    REQUIRE(decode(pd, over, got) == tipsy::DecoderResult::BODY_READY);
+    REQUIRE(got == over);
+    REQUIRE(decode(pd, longest, got) == tipsy::DecoderResult::BODY_READY);
+    REQUIRE(got == longest);
+    REQUIRE(pd.getMimeType() == mimeBuffer);
+    REQUIRE(std::string((const char *)buffer) == message);
+
+    // and back to the decoder's own storage
+    REQUIRE(pd.provideMimeTypeBuffer(nullptr));
+    REQUIRE(decode(pd, over, got) == tipsy::DecoderResult::ERROR_DATA_TOO_LARGE);
+    REQUIRE(decode(pd, fits, got) == tipsy::DecoderResult::BODY_READY);
+    REQUIRE(got == fits);
+}
+
 TEST_CASE("Sentinel Display Name")
 {
 #define CK(s) REQUIRE(std::string("tipsy::") + tipsy::sentinelDisplayName(s) == #s);
@@ -419,4 +478,1398 @@ TEST_CASE("Encoder Error Cases")
         REQUIRE(pe.isError(status));
         REQUIRE(status == tipsy::EncoderResult::ERROR_NO_MESSAGE_ACTIVE);
     }
-}
\ No newline at end of file
+}
+TEST_CASE("Bulk Body Read Matches Per Float Read")
+{
+    static constexpr int maxBufferSz{1024};
+    static const char *mt{"test/type"};
+
+    unsigned char inB[maxBufferSz], outB[maxBufferSz];
+    for (int j = 0; j < maxBufferSz; ++j)
+        inB[j] = (unsigned char)((j * 31 + 5) & 255);
+
+    for (auto bs : {0, 1, 2, 3, 4, 5, 6, 7, 191, 192, 193, 700})
+    {
+        DYNAMIC_SECTION("Message Size " << bs)
+        {
+            memset(outB, 0, sizeof(outB));
+
+            tipsy::ProtocolEncoder pe;
+            auto status = pe.initiateMessage(mt, bs, inB);
+            REQUIRE(status == tipsy::EncoderResult::MESSAGE_INITIATED);
+
+            std::vector<float> stream;
+            float nf;
+            while (pe.getNextMessageFloat(nf) != tipsy::EncoderResult::MESSAGE_COMPLETE)
+                stream.push_back(nf);
+            stream.push_back(nf);
+
+            tipsy::ProtocolDecoder pd;
+            pd.provideDataBuffer(outB, maxBufferSz);
+
+            bool gotBody{false};
+            size_t i{0}, bulk{0};
+            while (i < stream.size())
+            {
+                auto consumed = pd.readBodyFloats(stream.data() + i, stream.size() - i);
+                i += consumed;
+                bulk += consumed;
+                if (i == stream.size())
+                    break;
+
+                auto rf = pd.readFloat(stream[i++]);
+                REQUIRE(!tipsy::ProtocolDecoder::isError(rf));
+                if (rf == tipsy::DecoderResult::BODY_READY)
+                    gotBody = true;
+            }
+            REQUIRE(gotBody);
+            REQUIRE(bulk == (size_t)(bs > 3 ? (bs - 1) / 3 : 0));
+            REQUIRE(pd.getDataSize() == (uint32_t)bs);
+            REQUIRE(memcmp(inB, outB, bs) == 0);
+        }
+    }
+}
+
+TEST_CASE("Validate Protocol Stream")
+{
+    static constexpr size_t n{203};
+    float stream[n];
+    for (size_t i = 0; i < n; ++i)
+        stream[i] = tipsy::threeBytesToFloat(i & 255, (i * 7) & 255, (i * 13) & 255);
+
+    std::vector<size_t> sentinelAt{0, 1, 2, 17, 63, 64, 130, 202};
+    for (auto s : sentinelAt)
+        stream[s] = tipsy::kAllSentinels[s % tipsy::kNumSentinels];
+
+    auto detected = tipsy::detectSimdLevel();
+    for (int li = 0; li <= (int)detected; ++li)
+    {
+        auto k = tipsy::kernelsForLevel((tipsy::SimdLevel)li);
+        DYNAMIC_SECTION("Level " << tipsy::simdLevelName(k.level))
+        {
+            auto check = [&](const float *f, size_t sz, uint64_t *mask) {
+                memset(mask, 0, ((sz + 63) / 64) * sizeof(uint64_t));
+                return k.validateFloats(f, sz, 0.f, tipsy::maximumEncodedFloat(),
+                                        tipsy::kAllSentinels, tipsy::kNumSentinels, mask);
+            };
+
+            uint64_t mask[(n + 63) / 64];
+            REQUIRE(check(stream, n, mask) == n);
+            for (size_t i = 0; i < n; ++i)
+            {
+                bool isS = std::find(sentinelAt.begin(), sentinelAt.end(), i) != sentinelAt.end();
+                INFO("Checking mask at " << i);
+                REQUIRE(((mask[i / 64] >> (i % 64)) & 1) == (isS ? 1 : 0));
+            }
+
+            for (auto bad : {(size_t)0, (size_t)3, (size_t)64, (size_t)150, n - 1})
+            {
+                for (auto v : {1.5f, -2.f, std::numeric_limits<float>::quiet_NaN()})
+                {
+                    INFO("Bad value " << v << " at " << bad);
+                    float copy[n];
+                    memcpy(copy, stream, sizeof(copy));
+                    copy[bad] = v;
+                    REQUIRE(check(copy, n, mask) == bad);
+                    for (size_t i = bad; i < n; ++i)
+                        REQUIRE(((mask[i / 64] >> (i % 64)) & 1) == 0);
+                    if (bad > 2)
+                        REQUIRE((mask[0] & 7) == 7);
+                }
+            }
+        }
+    }
+
+    SECTION("Public API Agrees With isValidProtocolEncoding")
+    {
+        uint64_t mask[(n + 63) / 64];
+        REQUIRE(tipsy::validateProtocolStream(stream, n, mask) == n);
+        stream[99] = 4.f;
+        REQUIRE(!tipsy::isValidProtocolEncoding(stream[99]));
+        REQUIRE(tipsy::validateProtocolStream(stream, n) == 99);
+    }
+}
+
+TEST_CASE("Dormant Decoder Skips Idle Input")
+{
+    for (size_t i = 0; i < tipsy::kNumSentinels; ++i)
+    {
+        REQUIRE(tipsy::kAllSentinels[i] >= tipsy::kLowestSentinel);
+        REQUIRE(tipsy::kAllSentinels[i] <= tipsy::kHighestSentinel);
+    }
+
+    const char *mimeType{"application/text"};
+    const char *message{"I am the very model of a modern major general"};
+    unsigned char buffer[2048];
+
+    // Idle voltages, including some in the sentinel range which aren't sentinels, then a message
+    std::vector<float> stream;
+    for (int i = 0; i < 1000; ++i)
+        stream.push_back((i % 50 == 7) ? 3.25f : (i % 10) * 0.5f - 2.f);
+    auto idleSize = stream.size();
+
+    tipsy::ProtocolEncoder pe;
+    auto status = pe.initiateMessage(mimeType, strlen(message) + 1, (const unsigned char *)message);
+    REQUIRE(status == tipsy::EncoderResult::MESSAGE_INITIATED);
+    float nf;
+    while (pe.getNextMessageFloat(nf) != tipsy::EncoderResult::MESSAGE_COMPLETE)
+        stream.push_back(nf);
+    stream.push_back(nf);
+    for (int i = 0; i < 100; ++i)
+        stream.push_back(0.f);
+
+    tipsy::ProtocolDecoder reference;
+    for (size_t i = 0; i < idleSize; ++i)
+        REQUIRE(reference.readFloat(stream[i]) == tipsy::DecoderResult::DORMANT);
+
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(buffer, 2048);
+    bool gotBody{false};
+    size_t i{0}, skipped{0};
+    while (i < stream.size())
+    {
+        auto s = pd.skipDormantFloats(stream.data() + i, stream.size() - i);
+        skipped += s;
+        i += s;
+        if (i == stream.size())
+            break;
+
+        auto rf = pd.readFloat(stream[i++]);
+        REQUIRE(!tipsy::ProtocolDecoder::isError(rf));
+        if (rf == tipsy::DecoderResult::BODY_READY)
+        {
+            REQUIRE(std::string((const char *)buffer) == std::string(message));
+            gotBody = true;
+        }
+    }
+    REQUIRE(gotBody);
+    REQUIRE(skipped == idleSize + 100);
+}
+
+#if __cplusplus >= 201703L
+TEST_CASE("Static Message Matches Encoder")
+{
+    static constexpr tipsy::StaticMessage hello("application/text", "Hello from compile time");
+    static_assert(hello.size() == 3 + 6 + 6 + 1 + 8 + 1, "Static message size");
+    static_assert(hello[0] == tipsy::kMessageBeginSentinel, "Starts with begin");
+    static_assert(hello[hello.size() - 1] == tipsy::kEndMessageSentinel, "Ends with end");
+
+    static constexpr unsigned char binary[]{0, 1, 2, 3, 254, 255, 128, 127};
+    static constexpr tipsy::StaticMessage bin("app/bin", binary);
+
+    auto compare = [](const auto &msg, const char *mt, uint32_t sz, const unsigned char *d) {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateMessage(mt, sz, d) == tipsy::EncoderResult::MESSAGE_INITIATED);
+
+        std::vector<float> stream;
+        float nf;
+        while (pe.getNextMessageFloat(nf) != tipsy::EncoderResult::MESSAGE_COMPLETE)
+            stream.push_back(nf);
+        stream.push_back(nf);
+
+        REQUIRE(stream.size() == msg.size());
+        for (size_t i = 0; i < stream.size(); ++i)
+        {
+            INFO("Comparing at " << i);
+            REQUIRE(memcmp(&stream[i], msg.data() + i, sizeof(float)) == 0);
+        }
+    };
+
+    const char *msg{"Hello from compile time"};
+    compare(hello, "application/text", strlen(msg) + 1, (const unsigned char *)msg);
+    compare(bin, "app/bin", sizeof(binary), binary);
+
+    unsigned char buffer[128];
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(buffer, sizeof(buffer));
+    bool gotBody{false};
+    for (auto f : hello)
+    {
+        auto rf = pd.readFloat(f);
+        REQUIRE(!tipsy::ProtocolDecoder::isError(rf));
+        if (rf == tipsy::DecoderResult::BODY_READY)
+        {
+            REQUIRE(std::string(pd.getMimeType()) == "application/text");
+            REQUIRE(std::string((const char *)buffer) == msg);
+            gotBody = true;
+        }
+    }
+    REQUIRE(gotBody);
+}
+#endif
+
+TEST_CASE("Dense Version 2 Messages")
+{
+    static constexpr int maxBufferSz{1024};
+    static const char *mt{"test/dense"};
+
+    unsigned char inB[maxBufferSz], outB[maxBufferSz];
+    for (int j = 0; j < maxBufferSz; ++j)
+        inB[j] = (unsigned char)((j * 37 + 11) & 255);
+
+    auto encode = [&](uint16_t version, int bs) {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.setEncodingVersion(version));
+        REQUIRE(pe.getEncodingVersion() == version);
+        REQUIRE(pe.initiateMessage(mt, bs, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        REQUIRE(!pe.setEncodingVersion(tipsy::kVersion24Bit));
+
+        std::vector<float> stream;
+        float nf;
+        while (pe.getNextMessageFloat(nf) != tipsy::EncoderResult::MESSAGE_COMPLETE)
+            stream.push_back(nf);
+        stream.push_back(nf);
+        return stream;
+    };
+
+    SECTION("Per Float And Bulk Decode")
+    {
+        for (int bs = 0; bs < 300; ++bs)
+        {
+            auto stream = encode(tipsy::kVersion28Bit, bs);
+            REQUIRE(tipsy::validateProtocolStream(stream.data(), stream.size(), nullptr,
+                                                  tipsy::kVersion28Bit) == stream.size());
+
+            for (auto bulk : {false, true})
+            {
+                INFO("Message size " << bs << " bulk " << bulk);
+                memset(outB, 0, sizeof(outB));
+                tipsy::ProtocolDecoder pd;
+                pd.provideDataBuffer(outB, maxBufferSz);
+
+                bool gotBody{false};
+                size_t i{0};
+                while (i < stream.size())
+                {
+                    if (bulk)
+                    {
+                        i += pd.readBodyFloats(stream.data() + i, stream.size() - i);
+                        if (i == stream.size())
+                            break;
+                    }
+                    auto rf = pd.readFloat(stream[i++]);
+                    REQUIRE(!tipsy::ProtocolDecoder::isError(rf));
+                    if (rf == tipsy::DecoderResult::BODY_READY)
+                        gotBody = true;
+                }
+                REQUIRE(gotBody);
+                REQUIRE(pd.getVersion() == tipsy::kVersion28Bit);
+                REQUIRE(pd.getDataSize() == (uint32_t)bs);
+                REQUIRE(std::string(pd.getMimeType()) == mt);
+                REQUIRE(memcmp(inB, outB, bs) == 0);
+                REQUIRE(outB[bs] == 0);
+            }
+        }
+    }
+
+    SECTION("Dense Streams Are Shorter")
+    {
+        auto v1 = encode(tipsy::kVersion24Bit, maxBufferSz - 1);
+        auto v2 = encode(tipsy::kVersion28Bit, maxBufferSz - 1);
+        REQUIRE(v2.size() < v1.size());
+        REQUIRE(v2.size() < v1.size() * 7 / 8);
+
+        // a version 2 body is not a valid version 1 stream
+        REQUIRE(tipsy::validateProtocolStream(v2.data(), v2.size()) < v2.size());
+    }
+
+    SECTION("Unknown Versions Are Refused")
+    {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(!pe.setEncodingVersion(0));
+        REQUIRE(!pe.setEncodingVersion(tipsy::kVersion + 1));
+        REQUIRE(pe.getEncodingVersion() == tipsy::kVersion24Bit);
+    }
+}
+
+TEST_CASE("Block Encode Matches Per Float Encode")
+{
+    static constexpr int maxBufferSz{1500};
+    static const char *mt{"test/block"};
+
+    unsigned char inB[maxBufferSz];
+    for (int j = 0; j < maxBufferSz; ++j)
+        inB[j] = (unsigned char)((j * 23 + 1) & 255);
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        for (auto bs : {0, 1, 2, 3, 5, 7, 8, 100, 191, 192, 193, 1499})
+        {
+            std::vector<float> reference;
+            {
+                tipsy::ProtocolEncoder pe;
+                REQUIRE(pe.setEncodingVersion(version));
+                REQUIRE(pe.initiateMessage(mt, bs, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+                float nf;
+                while (pe.getNextMessageFloat(nf) != tipsy::EncoderResult::MESSAGE_COMPLETE)
+                    reference.push_back(nf);
+                reference.push_back(nf);
+            }
+
+            for (size_t block : {1, 2, 3, 7, 64, 512, 4096})
+            {
+                INFO("Version " << version << " size " << bs << " block " << block);
+                tipsy::ProtocolEncoder pe;
+                REQUIRE(pe.setEncodingVersion(version));
+                REQUIRE(pe.initiateMessage(mt, bs, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+
+                std::vector<float> stream;
+                std::vector<float> buf(block);
+                while (!pe.isDormant())
+                {
+                    auto w = pe.getNextMessageFloats(buf.data(), block);
+                    REQUIRE(w > 0);
+                    REQUIRE((w == block || pe.isDormant()));
+                    stream.insert(stream.end(), buf.begin(), buf.begin() + w);
+                }
+                REQUIRE(pe.getNextMessageFloats(buf.data(), block) == 0);
+                REQUIRE(stream.size() == reference.size());
+                REQUIRE(memcmp(stream.data(), reference.data(), stream.size() * sizeof(float)) ==
+                        0);
+            }
+        }
+    }
+}
+
+TEST_CASE("Header Is Encoded At Initiate")
+{
+    char mimeType[64];
+    strcpy(mimeType, "application/x-initiate-time");
+    const char *message{"body"};
+
+    tipsy::ProtocolEncoder pe;
+    REQUIRE(pe.initiateMessage(mimeType, strlen(message) + 1, (const unsigned char *)message) ==
+            tipsy::EncoderResult::MESSAGE_INITIATED);
+
+    // the mime type is only read in initiateMessage, so scribbling on it is harmless
+    strcpy(mimeType, "scribbled");
+
+    unsigned char buffer[64];
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(buffer, sizeof(buffer));
+    bool gotHeader{false};
+    for (int i = 0; i < 100; ++i)
+    {
+        float nf;
+        auto st = pe.getNextMessageFloat(nf);
+        REQUIRE(!pe.isError(st));
+        auto rf = pd.readFloat(nf);
+        REQUIRE(!tipsy::ProtocolDecoder::isError(rf));
+        if (rf == tipsy::DecoderResult::HEADER_READY)
+        {
+            REQUIRE(std::string(pd.getMimeType()) == "application/x-initiate-time");
+            gotHeader = true;
+        }
+    }
+    REQUIRE(gotHeader);
+}
+
+TEST_CASE("Segmented Body Matches Contiguous Body")
+{
+    static constexpr uint32_t bs{1000};
+    unsigned char inB[bs];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 29 + 11);
+    const char *mt{"application/x-segments"};
+
+    auto drain = [](tipsy::ProtocolEncoder &pe, size_t block) {
+        std::vector<float> res, buf(block);
+        while (!pe.isDormant())
+        {
+            if (block == 1)
+            {
+                float nf;
+                REQUIRE(!pe.isError(pe.getNextMessageFloat(nf)));
+                res.push_back(nf);
+            }
+            else
+            {
+                auto w = pe.getNextMessageFloats(buf.data(), block);
+                res.insert(res.end(), buf.begin(), buf.begin() + w);
+            }
+        }
+        return res;
+    };
+
+    // Each layout is a list of segment sizes which add up to bs; zero sizes are allowed
+    std::vector<std::vector<uint32_t>> layouts{
+        {bs},       {1, bs - 1},          {2, 0, 0, bs - 2}, {500, 500},
+        {4, 5, 991}, {1, 1, 1, 1, 996, 0}, {bs - 1, 1},       {7, 7, 13, 333, 640}};
+    std::vector<uint32_t> ones(bs, 1);
+    layouts.push_back(ones);
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        tipsy::ProtocolEncoder ref;
+        REQUIRE(ref.setEncodingVersion(version));
+        REQUIRE(ref.initiateMessage(mt, bs, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        auto expected = drain(ref, 1);
+
+        for (size_t l = 0; l < layouts.size(); ++l)
+        {
+            std::vector<tipsy::DataSegment> segs;
+            uint32_t off{0};
+            for (auto sz : layouts[l])
+            {
+                segs.push_back({inB + off, sz});
+                off += sz;
+            }
+            REQUIRE(off == bs);
+
+            for (size_t block : {1, 5, 64, 4096})
+            {
+                INFO("Version " << version << " layout " << l << " block " << block);
+                tipsy::ProtocolEncoder pe;
+                REQUIRE(pe.setEncodingVersion(version));
+                REQUIRE(pe.initiateMessage(mt, segs.data(), segs.size()) ==
+                        tipsy::EncoderResult::MESSAGE_INITIATED);
+                auto got = drain(pe, block);
+                REQUIRE(got.size() == expected.size());
+                REQUIRE(memcmp(got.data(), expected.data(), got.size() * sizeof(float)) == 0);
+            }
+        }
+    }
+
+    tipsy::ProtocolEncoder pe;
+    tipsy::DataSegment bad[2]{{inB, 10}, {nullptr, 4}};
+    REQUIRE(pe.initiateMessage(mt, bad, 2) == tipsy::EncoderResult::ERROR_MISSING_DATA);
+    REQUIRE(pe.initiateMessage(mt, nullptr, 1) == tipsy::EncoderResult::ERROR_MISSING_DATA);
+    tipsy::DataSegment huge[2]{{inB, tipsy::kMaxMessageLength}, {inB, 1}};
+    REQUIRE(pe.initiateMessage(mt, huge, 2) == tipsy::EncoderResult::ERROR_MESSAGE_TOO_LARGE);
+    REQUIRE(pe.initiateMessage(nullptr, bad, 1) == tipsy::EncoderResult::ERROR_MISSING_MIME_TYPE);
+
+    // the same mistakes give the same errors as with a contiguous body
+    tipsy::DataSegment hugeMissing[2]{{nullptr, tipsy::kMaxMessageLength}, {inB, 1}};
+    REQUIRE(pe.initiateMessage(mt, hugeMissing, 2) ==
+            tipsy::EncoderResult::ERROR_MESSAGE_TOO_LARGE);
+    REQUIRE(pe.initiateMessage(mt, tipsy::kMaxMessageLength + 1, nullptr) ==
+            tipsy::EncoderResult::ERROR_MESSAGE_TOO_LARGE);
+    REQUIRE(pe.initiateMessage(nullptr, bad, 2) == tipsy::EncoderResult::ERROR_MISSING_DATA);
+    REQUIRE(pe.initiateMessage(nullptr, 14, nullptr) == tipsy::EncoderResult::ERROR_MISSING_DATA);
+
+    REQUIRE(pe.initiateMessage(mt, nullptr, 0) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    REQUIRE(pe.initiateMessage(mt, bad, 1) == tipsy::EncoderResult::ERROR_MESSAGE_ALREADY_ACTIVE);
+}
+
+namespace
+{
+// Hands out the body in uneven pieces and now and then has nothing ready for a while
+struct StutteringProducer
+{
+    const unsigned char *src;
+    uint32_t size, pos, calls;
+    bool stall;
+
+    static uint32_t produce(void *ud, unsigned char *dest, uint32_t maxBytes)
+    {
+        auto *that = static_cast<StutteringProducer *>(ud);
+        that->calls++;
+        if (that->stall && (that->calls / 8) % 4 == 1)
+            return 0;
+        uint32_t n = 1 + (that->calls * 37) % 50;
+        n = n < maxBytes ? n : maxBytes;
+        n = n < that->size - that->pos ? n : that->size - that->pos;
+        memcpy(dest, that->src + that->pos, n);
+        that->pos += n;
+        return n;
+    }
+};
+} // namespace
+
+TEST_CASE("Streaming Body From A Producer")
+{
+    static constexpr uint32_t bs{5000};
+    unsigned char inB[bs];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 13 + 7);
+    const char *mt{"application/x-stream"};
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        for (uint32_t sz : {0u, 1u, 2u, 3u, 7u, 8u, 224u, 225u, bs})
+        {
+            for (size_t block : {1, 16, 1024})
+            {
+                INFO("Version " << version << " size " << sz << " block " << block);
+
+                // A producer which never stalls gives exactly the contiguous stream
+                tipsy::ProtocolEncoder ref, smooth;
+                REQUIRE(ref.setEncodingVersion(version));
+                REQUIRE(smooth.setEncodingVersion(version));
+                REQUIRE(ref.initiateMessage(mt, sz, inB) ==
+                        tipsy::EncoderResult::MESSAGE_INITIATED);
+                StutteringProducer sp{inB, sz, 0, 0, false};
+                REQUIRE(smooth.initiateStreamingMessage(mt, sz, StutteringProducer::produce,
+                                                        &sp) ==
+                        tipsy::EncoderResult::MESSAGE_INITIATED);
+                std::vector<float> a, b, buf(block);
+                while (!ref.isDormant())
+                {
+                    auto w = ref.getNextMessageFloats(buf.data(), block);
+                    a.insert(a.end(), buf.begin(), buf.begin() + w);
+                }
+                while (!smooth.isDormant())
+                {
+                    auto w = smooth.getNextMessageFloats(buf.data(), block);
+                    b.insert(b.end(), buf.begin(), buf.begin() + w);
+                }
+                // ... apart from the flag which keeps older decoders from reading it
+                REQUIRE(a.size() == b.size());
+                REQUIRE(b[4] == tipsy::FloatBytes((uint16_t)(version | tipsy::kStreamingFlag)).f);
+                b[4] = a[4];
+                REQUIRE(memcmp(a.data(), b.data(), a.size() * sizeof(float)) == 0);
+
+                // A stalling one pads the body with zeros which the decoder skips
+                tipsy::ProtocolEncoder pe;
+                REQUIRE(pe.setEncodingVersion(version));
+                StutteringProducer st{inB, sz, 0, 0, true};
+                REQUIRE(pe.initiateStreamingMessage(mt, sz, StutteringProducer::produce,
+                                                    &st) ==
+                        tipsy::EncoderResult::MESSAGE_INITIATED);
+                std::vector<float> stream;
+                while (!pe.isDormant())
+                {
+                    auto w = pe.getNextMessageFloats(buf.data(), block);
+                    stream.insert(stream.end(), buf.begin(), buf.begin() + w);
+                }
+                if (sz == bs)
+                    REQUIRE(std::count(stream.begin(), stream.end(), 0.f) > 0);
+                // the stalls are valid in either version, and are not sentinels
+                std::vector<uint64_t> mask((stream.size() + 63) / 64);
+                REQUIRE(tipsy::validateProtocolStream(stream.data(), stream.size(), mask.data(),
+                                                      version) == stream.size());
+                for (size_t k = 0; k < stream.size(); ++k)
+                    REQUIRE(((mask[k / 64] >> (k % 64)) & 1u) ==
+                            (uint64_t)tipsy::isValidSentinel(stream[k]));
+
+                for (bool bulk : {false, true})
+                {
+                    unsigned char outB[bs + 1];
+                    memset(outB, 0, sizeof(outB));
+                    tipsy::ProtocolDecoder pd;
+                    pd.provideDataBuffer(outB, sizeof(outB));
+                    bool done{false};
+                    size_t i{0};
+                    while (i < stream.size())
+                    {
+                        if (bulk)
+                            i += pd.readBodyFloats(stream.data() + i, stream.size() - i);
+                        if (i == stream.size())
+                            break;
+                        auto dr = pd.readFloat(stream[i++]);
+                        REQUIRE(!tipsy::ProtocolDecoder::isError(dr));
+                        if (dr == tipsy::DecoderResult::BODY_READY)
+                            done = true;
+                    }
+                    REQUIRE(done);
+                    REQUIRE(pd.getDataSize() == sz);
+                    REQUIRE(memcmp(outB, inB, sz) == 0);
+                }
+            }
+        }
+    }
+
+    tipsy::ProtocolEncoder pe;
+    REQUIRE(pe.initiateStreamingMessage(mt, 10, nullptr, nullptr) ==
+            tipsy::EncoderResult::ERROR_MISSING_DATA);
+    REQUIRE(pe.initiateStreamingMessage(mt, tipsy::kMaxMessageLength + 1,
+                                        StutteringProducer::produce,
+                                        nullptr) == tipsy::EncoderResult::ERROR_MESSAGE_TOO_LARGE);
+}
+
+TEST_CASE("Session Messages Elide The Header")
+{
+    static constexpr uint32_t bs{100};
+    unsigned char inB[bs], outB[bs + 1];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 7 + 3);
+    const char *mt{"application/x-control"};
+
+    auto drain = [](tipsy::ProtocolEncoder &pe, std::vector<float> &stream, size_t block) {
+        std::vector<float> buf(block);
+        while (!pe.isDormant())
+        {
+            auto w = pe.getNextMessageFloats(buf.data(), block);
+            stream.insert(stream.end(), buf.begin(), buf.begin() + w);
+        }
+    };
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        for (size_t block : {1, 64})
+        {
+            INFO("Version " << version << " block " << block);
+            tipsy::ProtocolEncoder pe;
+            REQUIRE(pe.setEncodingVersion(version));
+            REQUIRE(pe.initiateSessionMessage(1, inB) ==
+                    tipsy::EncoderResult::ERROR_NO_SESSION_ACTIVE);
+            REQUIRE(pe.initiateSession(mt, 5, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+            REQUIRE(pe.isInSession());
+            REQUIRE(!pe.setEncodingVersion(tipsy::kVersion24Bit));
+
+            std::vector<float> stream;
+            drain(pe, stream, block);
+            std::vector<size_t> ends{stream.size()};
+            std::vector<uint32_t> sizes{5};
+            for (uint32_t sz = 0; sz <= 16; ++sz)
+            {
+                auto before = stream.size();
+                REQUIRE(pe.initiateSessionMessage(sz, inB + sz) ==
+                        tipsy::EncoderResult::MESSAGE_INITIATED);
+                drain(pe, stream, block);
+                // size sentinel, size, body, end
+                auto bodyFloats = version == tipsy::kVersion28Bit ? (sz + 6) / 7 * 2 : (sz + 2) / 3;
+                REQUIRE(stream.size() - before == 3 + bodyFloats);
+                ends.push_back(stream.size());
+                sizes.push_back(sz);
+            }
+
+            // a full header message ends the session
+            REQUIRE(pe.initiateMessage("b", 4, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+            REQUIRE(!pe.isInSession());
+            drain(pe, stream, block);
+            ends.push_back(stream.size());
+            sizes.push_back(4);
+            REQUIRE(pe.initiateSessionMessage(1, inB) ==
+                    tipsy::EncoderResult::ERROR_NO_SESSION_ACTIVE);
+
+            tipsy::ProtocolDecoder pd;
+            pd.provideDataBuffer(outB, sizeof(outB));
+            size_t m{0};
+            for (size_t i = 0; i < stream.size(); ++i)
+            {
+                auto r = pd.readFloat(stream[i]);
+                REQUIRE(!tipsy::ProtocolDecoder::isError(r));
+                if (r == tipsy::DecoderResult::BODY_READY)
+                {
+                    REQUIRE(i + 1 == ends[m]);
+                    REQUIRE(pd.getDataSize() == sizes[m]);
+                    REQUIRE(pd.getVersion() == version);
+                    auto last = m + 1 == ends.size();
+                    REQUIRE(pd.isInSession() == !last);
+                    REQUIRE(std::string(pd.getMimeType()) == (last ? "b" : mt));
+                    auto off = (m == 0 || last) ? 0 : sizes[m];
+                    REQUIRE(memcmp(outB, inB + off, sizes[m]) == 0);
+                    m++;
+                }
+            }
+            REQUIRE(m == ends.size());
+        }
+    }
+
+    SECTION("Short Headers Without A Session Are Refused")
+    {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateSession(mt, 0, nullptr) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        float f;
+        while (!pe.isDormant())
+            (void)pe.getNextMessageFloat(f);
+        REQUIRE(pe.initiateSessionMessage(3, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+
+        // a decoder which missed the opening message
+        tipsy::ProtocolDecoder pd;
+        pd.provideDataBuffer(outB, sizeof(outB));
+        bool sawError{false};
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            auto r = pd.readFloat(f);
+            REQUIRE(r != tipsy::DecoderResult::HEADER_READY);
+            if (r == tipsy::DecoderResult::ERROR_MALFORMED_HEADER)
+                sawError = true;
+        }
+        REQUIRE(sawError);
+        REQUIRE(!pd.isInSession());
+
+        pe.endSession();
+        REQUIRE(pe.initiateSessionMessage(3, inB) ==
+                tipsy::EncoderResult::ERROR_NO_SESSION_ACTIVE);
+    }
+}
+
+TEST_CASE("Interned Mime Types")
+{
+    static constexpr uint32_t bs{20};
+    unsigned char inB[bs], outB[bs + 1];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 5 + 1);
+
+    static constexpr uint16_t entries{4};
+    char table[entries * tipsy::kMaxMimeTypeSize];
+
+    auto encode = [](tipsy::ProtocolEncoder &pe, std::vector<float> &stream) {
+        float f;
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            stream.push_back(f);
+        }
+    };
+
+    tipsy::InternedMimeType cc{"application/x-control-change", 2, false};
+    tipsy::InternedMimeType note{"application/x-note", 3, false};
+    tipsy::InternedMimeType wide{"application/x-past-the-table", 9, false};
+
+    tipsy::ProtocolEncoder pe;
+    std::vector<float> first, second, plain;
+    REQUIRE(pe.initiateMessage(cc, 6, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    REQUIRE(cc.announced);
+    encode(pe, first);
+    REQUIRE(pe.initiateMessage(cc, 6, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    encode(pe, second);
+    REQUIRE(pe.initiateMessage(cc.mimeType, 6, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+    encode(pe, plain);
+
+    // the reference drops the mime size and characters but adds an ID
+    REQUIRE(second.size() + (strlen(cc.mimeType) + 3) / 3 == plain.size());
+    REQUIRE(first.size() == plain.size() + 1);
+
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(outB, sizeof(outB));
+    REQUIRE(pd.provideMimeTypeTable(table, entries));
+
+    auto decode = [&](const std::vector<float> &stream) {
+        auto res = tipsy::DecoderResult::DORMANT;
+        for (auto f : stream)
+        {
+            auto r = pd.readFloat(f);
+            if (tipsy::ProtocolDecoder::isError(r))
+                return r;
+            if (r == tipsy::DecoderResult::BODY_READY)
+                res = r;
+        }
+        return res;
+    };
+
+    SECTION("Announce Then Refer")
+    {
+        REQUIRE(pd.getInternedMimeType(2) == nullptr);
+        REQUIRE(decode(first) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pd.getMimeTypeId() == 2);
+        REQUIRE(std::string(pd.getMimeType()) == cc.mimeType);
+        REQUIRE(std::string(pd.getInternedMimeType(2)) == cc.mimeType);
+
+        memset(outB, 0, sizeof(outB));
+        REQUIRE(decode(second) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pd.getMimeTypeId() == 2);
+        REQUIRE(std::string(pd.getMimeType()) == cc.mimeType);
+        REQUIRE(memcmp(outB, inB, 6) == 0);
+
+        REQUIRE(decode(plain) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pd.getMimeTypeId() == tipsy::kNoMimeTypeId);
+        REQUIRE(std::string(pd.getMimeType()) == cc.mimeType);
+
+        // interleaved with a second type and a reannouncement
+        std::vector<float> more;
+        REQUIRE(pe.initiateMessage(note, 1, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        encode(pe, more);
+        REQUIRE(pe.initiateMessage(cc, 2, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        encode(pe, more);
+        cc.announced = false;
+        REQUIRE(pe.initiateMessage(cc, 3, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        encode(pe, more);
+        REQUIRE(pe.initiateMessage(note, 4, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        encode(pe, more);
+        REQUIRE(decode(more) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pd.getMimeTypeId() == 3);
+        REQUIRE(pd.getDataSize() == 4);
+        REQUIRE(std::string(pd.getMimeType()) == note.mimeType);
+        REQUIRE(std::string(pd.getInternedMimeType(2)) == cc.mimeType);
+    }
+
+    SECTION("Unknown IDs Are Refused")
+    {
+        REQUIRE(decode(second) == tipsy::DecoderResult::ERROR_UNKNOWN_MIME_TYPE_ID);
+
+        // announcements past the table decode but are not remembered
+        std::vector<float> a, b;
+        REQUIRE(pe.initiateMessage(wide, 1, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        encode(pe, a);
+        REQUIRE(pe.initiateMessage(wide, 1, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        encode(pe, b);
+        REQUIRE(decode(a) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(std::string(pd.getMimeType()) == wide.mimeType);
+        REQUIRE(pd.getMimeTypeId() == 9);
+        REQUIRE(decode(b) == tipsy::DecoderResult::ERROR_UNKNOWN_MIME_TYPE_ID);
+
+        tipsy::InternedMimeType bad{"a", tipsy::kNoMimeTypeId, false};
+        REQUIRE(pe.initiateMessage(bad, 1, inB) ==
+                tipsy::EncoderResult::ERROR_INVALID_MIME_TYPE_ID);
+    }
+
+    SECTION("Decoders Without A Table Still Take Announcements")
+    {
+        tipsy::ProtocolDecoder nt;
+        nt.provideDataBuffer(outB, sizeof(outB));
+        for (auto f : first)
+            REQUIRE(!tipsy::ProtocolDecoder::isError(nt.readFloat(f)));
+        REQUIRE(std::string(nt.getMimeType()) == cc.mimeType);
+        REQUIRE(nt.getInternedMimeType(2) == nullptr);
+    }
+}
+
+TEST_CASE("Block Decode Reports Events")
+{
+    static constexpr uint32_t bs{600};
+    // message m starts m bytes in, so leave room past bs for the offsets
+    unsigned char inB[bs + 8], outB[bs + 1];
+    for (uint32_t i = 0; i < sizeof(inB); ++i)
+        inB[i] = (unsigned char)(i * 11 + 5);
+
+    // messages of a few sizes and both versions with idle stretches between them
+    std::vector<float> stream(37, 0.f);
+    std::vector<uint32_t> sizes{0, 1, 5, 100, 599, 64};
+    REQUIRE(sizes.size() <= sizeof(inB) - bs);
+    for (size_t m = 0; m < sizes.size(); ++m)
+    {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.setEncodingVersion(m % 2 ? tipsy::kVersion28Bit : tipsy::kVersion24Bit));
+        REQUIRE(pe.initiateMessage("a/b", sizes[m], inB + m) ==
+                tipsy::EncoderResult::MESSAGE_INITIATED);
+        float f;
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            stream.push_back(f);
+        }
+        stream.insert(stream.end(), m * 13, 0.f);
+    }
+    // and a broken header
+    stream.push_back(tipsy::kMessageBeginSentinel);
+    stream.push_back(tipsy::kVersionSentinel);
+    stream.push_back(tipsy::FloatBytes((uint16_t)0x0f));
+
+    std::vector<tipsy::DecoderEvent> expected;
+    {
+        tipsy::ProtocolDecoder pd;
+        pd.provideDataBuffer(outB, sizeof(outB));
+        for (size_t i = 0; i < stream.size(); ++i)
+        {
+            auto r = pd.readFloat(stream[i]);
+            if (r == tipsy::DecoderResult::HEADER_READY ||
+                r == tipsy::DecoderResult::BODY_READY || tipsy::ProtocolDecoder::isError(r))
+                expected.push_back({r, (uint32_t)i});
+        }
+    }
+    REQUIRE(expected.size() == 2 * sizes.size() + 1);
+
+    for (size_t block : {1, 7, 64, 4096})
+    {
+        for (size_t maxEvents : {1, 3, 16})
+        {
+            INFO("Block " << block << " max events " << maxEvents);
+            tipsy::ProtocolDecoder pd;
+            pd.provideDataBuffer(outB, sizeof(outB));
+            std::vector<tipsy::DecoderEvent> got, ev(maxEvents);
+            size_t bodies{0};
+            for (size_t start = 0; start < stream.size(); start += block)
+            {
+                auto n = std::min(block, stream.size() - start);
+                size_t i{0};
+                while (i < n)
+                {
+                    auto e = pd.readFloats(stream.data() + start + i, n - i, ev.data(), maxEvents);
+                    for (size_t k = 0; k < e; ++k)
+                    {
+                        got.push_back({ev[k].result, (uint32_t)(start + i + ev[k].offset)});
+                        if (ev[k].result == tipsy::DecoderResult::BODY_READY)
+                        {
+                            // nothing comes after a body, so it is still in the buffer
+                            REQUIRE(k == e - 1);
+                            REQUIRE(pd.getDataSize() == sizes[bodies]);
+                            REQUIRE(memcmp(outB, inB + bodies, sizes[bodies]) == 0);
+                            bodies++;
+                        }
+                    }
+                    if (e == 0 ||
+                        (e < maxEvents && ev[e - 1].result != tipsy::DecoderResult::BODY_READY))
+                        break;
+                    i += ev[e - 1].offset + 1;
+                }
+            }
+            REQUIRE(got.size() == expected.size());
+            for (size_t k = 0; k < got.size(); ++k)
+            {
+                REQUIRE(got[k].result == expected[k].result);
+                REQUIRE(got[k].offset == expected[k].offset);
+            }
+            REQUIRE(bodies == sizes.size());
+        }
+    }
+}
+
+namespace
+{
+struct CollectingSink
+{
+    std::vector<unsigned char> body;
+    std::string mimeType;
+    uint32_t announced{0};
+    int headers{0}, completes{0};
+    size_t largestChunk{0};
+
+    static void onHeader(void *ud, const char *mt, uint32_t sz)
+    {
+        auto s = (CollectingSink *)ud;
+        s->mimeType = mt;
+        s->announced = sz;
+        s->headers++;
+    }
+    static void onBodyChunk(void *ud, const unsigned char *d, uint32_t sz)
+    {
+        auto s = (CollectingSink *)ud;
+        s->body.insert(s->body.end(), d, d + sz);
+        s->largestChunk = std::max(s->largestChunk, (size_t)sz);
+    }
+    static void onComplete(void *ud) { ((CollectingSink *)ud)->completes++; }
+
+    tipsy::ProtocolDecoder::BodySink sink()
+    {
+        return {onHeader, onBodyChunk, onComplete, this};
+    }
+};
+} // namespace
+
+TEST_CASE("Body Sink Delivers In Bounded Chunks")
+{
+    static constexpr uint32_t bs{20000};
+    std::vector<unsigned char> inB(bs);
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 29 + i / 256);
+    static constexpr auto stage = tipsy::ProtocolDecoder::kSinkStageBytes;
+    unsigned char stageB[stage];
+
+    for (auto version : {tipsy::kVersion24Bit, tipsy::kVersion28Bit})
+    {
+        for (uint32_t sz : {0u, 1u, 5u, stage - 1, stage, stage + 1, 3 * stage, bs})
+        {
+            for (size_t block : {1, 13, 512})
+            {
+                INFO("Version " << version << " size " << sz << " block " << block);
+                tipsy::ProtocolEncoder pe;
+                REQUIRE(pe.setEncodingVersion(version));
+                REQUIRE(pe.initiateMessage("application/x-big", sz, inB.data()) ==
+                        tipsy::EncoderResult::MESSAGE_INITIATED);
+                std::vector<float> stream, buf(block);
+                while (!pe.isDormant())
+                {
+                    auto w = pe.getNextMessageFloats(buf.data(), block);
+                    stream.insert(stream.end(), buf.begin(), buf.begin() + w);
+                }
+
+                // no data buffer at all
+                CollectingSink cs;
+                auto s = cs.sink();
+                tipsy::ProtocolDecoder pd;
+                REQUIRE(!pd.provideBodySink(&s, nullptr));
+                REQUIRE(pd.provideBodySink(&s, stageB));
+                tipsy::DecoderEvent ev[4];
+                for (size_t start = 0; start < stream.size(); start += block)
+                {
+                    auto n = std::min(block, stream.size() - start);
+                    auto e = pd.readFloats(stream.data() + start, n, ev, 4);
+                    REQUIRE(e < 4);
+                    for (size_t k = 0; k < e; ++k)
+                        REQUIRE(!tipsy::ProtocolDecoder::isError(ev[k].result));
+                }
+                REQUIRE(cs.headers == 1);
+                REQUIRE(cs.completes == 1);
+                REQUIRE(cs.mimeType == "application/x-big");
+                REQUIRE(cs.announced == sz);
+                REQUIRE(pd.getDataSize() == sz);
+                REQUIRE(cs.largestChunk <= stage);
+                REQUIRE(cs.body.size() == sz);
+                REQUIRE(memcmp(cs.body.data(), inB.data(), sz) == 0);
+            }
+        }
+    }
+
+    SECTION("Chunked Frames Each Go To The Sink")
+    {
+        tipsy::ChunkedProtocolEncoder ce;
+        REQUIRE(ce.setChunkSize(3000));
+        REQUIRE(ce.initiateMessage("a", bs, inB.data()) ==
+                tipsy::EncoderResult::MESSAGE_INITIATED);
+        CollectingSink cs;
+        auto s = cs.sink();
+        tipsy::ProtocolDecoder pd;
+        REQUIRE(pd.provideBodySink(&s, stageB));
+        float f;
+        while (!ce.isDormant())
+        {
+            (void)ce.getNextMessageFloat(f);
+            REQUIRE(!tipsy::ProtocolDecoder::isError(pd.readFloat(f)));
+        }
+        REQUIRE(cs.headers == 7);
+        REQUIRE(cs.completes == 7);
+        REQUIRE(cs.body.size() == bs);
+        REQUIRE(memcmp(cs.body.data(), inB.data(), bs) == 0);
+    }
+
+    SECTION("Session Messages Each Go To The Sink")
+    {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateSession("application/x-control", 10, inB.data()) ==
+                tipsy::EncoderResult::MESSAGE_INITIATED);
+        CollectingSink cs;
+        auto s = cs.sink();
+        tipsy::ProtocolDecoder pd;
+        REQUIRE(pd.provideBodySink(&s, stageB));
+        float f;
+        uint32_t sent{10};
+        for (uint32_t m = 0; m <= 4; ++m)
+        {
+            while (!pe.isDormant())
+            {
+                (void)pe.getNextMessageFloat(f);
+                REQUIRE(!tipsy::ProtocolDecoder::isError(pd.readFloat(f)));
+            }
+            REQUIRE(cs.headers == (int)m + 1);
+            REQUIRE(cs.completes == (int)m + 1);
+            REQUIRE(cs.mimeType == "application/x-control");
+            REQUIRE(cs.body.size() == sent);
+            if (m < 4)
+            {
+                auto sz = 100 * m + 1;
+                REQUIRE(pe.initiateSessionMessage(sz, inB.data() + sent) ==
+                        tipsy::EncoderResult::MESSAGE_INITIATED);
+                sent += sz;
+            }
+        }
+        REQUIRE(cs.announced == 301);
+        REQUIRE(memcmp(cs.body.data(), inB.data(), sent) == 0);
+    }
+}
+
+TEST_CASE("Decode Buffers From A Pool")
+{
+    static constexpr uint32_t bs{3000};
+    unsigned char inB[bs];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 3 + 1);
+
+    tipsy::BufferPool pool{{64, 2}, {1024, 1}, {4096, 70}};
+    REQUIRE(pool.available(0) == 2);
+    REQUIRE(pool.available(2) == 70);
+
+    SECTION("Acquire And Release")
+    {
+        uint32_t cap{0};
+        auto a = pool.acquire(10, &cap);
+        REQUIRE(cap == 64);
+        auto b = pool.acquire(10);
+        auto c = pool.acquire(10, &cap);
+        REQUIRE(cap == 1024);
+        REQUIRE(a != b);
+        REQUIRE(pool.available(0) == 0);
+        std::vector<unsigned char *> big;
+        while (auto p = pool.acquire(1000))
+            big.push_back(p);
+        REQUIRE(big.size() == 70);
+        REQUIRE(pool.acquire(1) == nullptr);
+        REQUIRE(pool.acquire(5000) == nullptr);
+        pool.release(b);
+        REQUIRE(pool.acquire(1) == b);
+        pool.release(nullptr);
+        for (auto p : {a, b, c})
+            pool.release(p);
+        for (auto p : big)
+            pool.release(p);
+        REQUIRE(pool.available(0) == 2);
+        REQUIRE(pool.available(1) == 1);
+        REQUIRE(pool.available(2) == 70);
+    }
+
+    SECTION("Decoder Sizes From The Header")
+    {
+        tipsy::ProtocolDecoder pd;
+        REQUIRE(pd.provideBufferPool(&pool));
+
+        auto send = [&](uint32_t sz, unsigned char **detached) {
+            tipsy::ProtocolEncoder pe;
+            REQUIRE(pe.initiateMessage("a", sz, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+            auto res = tipsy::DecoderResult::DORMANT;
+            float f;
+            while (!pe.isDormant())
+            {
+                (void)pe.getNextMessageFloat(f);
+                auto r = pd.readFloat(f);
+                if (tipsy::ProtocolDecoder::isError(res))
+                    continue;
+                if (r == tipsy::DecoderResult::BODY_READY || tipsy::ProtocolDecoder::isError(r))
+                    res = r;
+                if (r == tipsy::DecoderResult::BODY_READY)
+                {
+                    REQUIRE(memcmp(pd.getData(), inB, sz) == 0);
+                    if (detached)
+                        *detached = pd.detachPooledBuffer();
+                }
+            }
+            return res;
+        };
+
+        // left with the decoder, each buffer comes back when the next message starts
+        for (uint32_t sz : {0u, 10u, 64u, 65u, 1024u, bs, 5u})
+        {
+            INFO("Size " << sz);
+            REQUIRE(send(sz, nullptr) == tipsy::DecoderResult::BODY_READY);
+        }
+        REQUIRE(send(1, nullptr) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pool.available(0) == 1);
+
+        // detached buffers stay out until the consumer releases them
+        unsigned char *held[2];
+        REQUIRE(send(40, &held[0]) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(send(40, &held[1]) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(held[0] != held[1]);
+        REQUIRE(pool.available(0) == 0);
+        REQUIRE(send(40, nullptr) == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pool.available(1) == 0);
+        REQUIRE(send(40, nullptr) == tipsy::DecoderResult::BODY_READY);
+
+        // too big for any class, and then an exhausted pool
+        REQUIRE(send(5000, nullptr) == tipsy::DecoderResult::ERROR_NO_BUFFER_AVAILABLE);
+        std::vector<unsigned char *> big;
+        while (auto p = pool.acquire(1))
+            big.push_back(p);
+        REQUIRE(send(3, nullptr) == tipsy::DecoderResult::ERROR_NO_BUFFER_AVAILABLE);
+        for (auto p : big)
+            pool.release(p);
+        pool.release(held[0]);
+        pool.release(held[1]);
+    }
+    REQUIRE(pool.available(0) == 2);
+}
+
+TEST_CASE("Decoders Move Mid Message")
+{
+    static constexpr uint32_t bs{300};
+    unsigned char inB[bs], outB[bs];
+    for (uint32_t i = 0; i < bs; ++i)
+        inB[i] = (unsigned char)(i * 5 + 1);
+    tipsy::BufferPool pool{{512, 40}};
+
+    auto encode = [&](const char *mt, uint32_t size) {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateMessage(mt, size, inB) == tipsy::EncoderResult::MESSAGE_INITIATED);
+        std::vector<float> res;
+        float f;
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            res.push_back(f);
+        }
+        return res;
+    };
+    auto mimeFor = [](size_t d) { return d % 2 ? "application/x-odd" : "text/even"; };
+
+    // each decoder is half way through a message, some in the header and some in the body,
+    // when the vector grows and moves it
+    std::vector<tipsy::ProtocolDecoder> decoders;
+    std::vector<std::vector<float>> streams;
+    for (uint32_t d = 0; d < 32; ++d)
+    {
+        decoders.emplace_back();
+        REQUIRE(decoders.back().provideBufferPool(&pool));
+        streams.push_back(encode(mimeFor(d), 10 + 9 * d));
+        for (size_t i = 0; i < streams[d].size() / 2; ++i)
+            REQUIRE(!tipsy::ProtocolDecoder::isError(decoders[d].readFloat(streams[d][i])));
+    }
+    REQUIRE(pool.available(0) == 8);
+
+    for (size_t d = 0; d < decoders.size(); ++d)
+    {
+        INFO("Decoder " << d);
+        bool gotBody{false};
+        for (size_t i = streams[d].size() / 2; i < streams[d].size(); ++i)
+        {
+            auto r = decoders[d].readFloat(streams[d][i]);
+            REQUIRE(!tipsy::ProtocolDecoder::isError(r));
+            gotBody = gotBody || r == tipsy::DecoderResult::BODY_READY;
+        }
+        REQUIRE(gotBody);
+        REQUIRE(std::string(decoders[d].getMimeType()) == mimeFor(d));
+        REQUIRE(decoders[d].getDataSize() == 10 + 9 * d);
+        REQUIRE(memcmp(decoders[d].getData(), inB, 10 + 9 * d) == 0);
+    }
+
+    // assignment hands the buffer over and leaves the source as if new
+    tipsy::ProtocolDecoder moved;
+    moved = std::move(decoders[3]);
+    REQUIRE(std::string(moved.getMimeType()) == mimeFor(3));
+    REQUIRE(memcmp(moved.getData(), inB, 37) == 0);
+    REQUIRE(decoders[3].getData() == nullptr);
+    REQUIRE(std::string(decoders[3].getMimeType()).empty());
+    decoders[3].provideDataBuffer(outB, sizeof(outB));
+    bool gotBody{false};
+    for (auto f : encode("a/b", 20))
+        gotBody = gotBody || decoders[3].readFloat(f) == tipsy::DecoderResult::BODY_READY;
+    REQUIRE(gotBody);
+    REQUIRE(memcmp(outB, inB, 20) == 0);
+
+    REQUIRE(pool.available(0) == 8);
+    decoders.clear();
+    REQUIRE(pool.available(0) == 39);
+    moved = tipsy::ProtocolDecoder();
+    REQUIRE(pool.available(0) == 40);
+}
+
+TEST_CASE("Resync Recovers From A Broken Stream")
+{
+    unsigned char inB[200], outB[64];
+    for (int i = 0; i < 200; ++i)
+        inB[i] = (unsigned char)(i * 7 + 3);
+
+    auto encode = [&](uint32_t size, uint32_t offset) {
+        tipsy::ProtocolEncoder pe;
+        REQUIRE(pe.initiateMessage("a/b", size, inB + offset) ==
+                tipsy::EncoderResult::MESSAGE_INITIATED);
+        std::vector<float> res;
+        float f;
+        while (!pe.isDormant())
+        {
+            (void)pe.getNextMessageFloat(f);
+            res.push_back(f);
+        }
+        return res;
+    };
+
+    SECTION("Explicit Resync Abandons The Message")
+    {
+        tipsy::ProtocolDecoder pd;
+        pd.provideDataBuffer(outB, sizeof(outB));
+
+        auto a = encode(40, 0), b = encode(20, 50);
+        size_t half = a.size() / 2;
+        for (size_t i = 0; i < half; ++i)
+            REQUIRE(!pd.isError(pd.readFloat(a[i])));
+        pd.resync();
+        REQUIRE(pd.isResyncing());
+
+        for (size_t i = half; i < a.size(); ++i)
+            REQUIRE(pd.readFloat(a[i]) == tipsy::DecoderResult::RESYNCING);
+        REQUIRE(pd.getDiscardedFloats() == a.size() - half);
+
+        REQUIRE(pd.readFloat(b[0]) == tipsy::DecoderResult::RESYNCING);
+        REQUIRE(pd.readFloat(b[1]) == tipsy::DecoderResult::RESYNCING);
+        REQUIRE(pd.readFloat(b[2]) == tipsy::DecoderResult::RESYNCED);
+        REQUIRE(!pd.isResyncing());
+        REQUIRE(pd.getDiscardedFloats() == a.size() - half);
+
+        auto r = tipsy::DecoderResult::DORMANT;
+        for (size_t i = 3; i < b.size(); ++i)
+            r = pd.readFloat(b[i]);
+        REQUIRE(r == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pd.isMessageComplete());
+        REQUIRE(pd.getDataSize() == 20);
+        REQUIRE(memcmp(outB, inB + 50, 20) == 0);
+    }
+
+    SECTION("Errors Resync When Asked")
+    {
+        tipsy::ProtocolDecoder pd;
+        pd.provideDataBuffer(outB, sizeof(outB));
+        pd.setResyncOnError(true);
+
+        // too large for the buffer, so everything after its size is discarded
+        auto a = encode(100, 0), b = encode(10, 5);
+        size_t errors{0}, resyncing{0};
+        for (auto f : a)
+        {
+            auto r = pd.readFloat(f);
+            errors += pd.isError(r);
+            resyncing += r == tipsy::DecoderResult::RESYNCING;
+        }
+        REQUIRE(errors == 1);
+        REQUIRE(pd.isResyncing());
+        REQUIRE(pd.getDiscardedFloats() == resyncing);
+
+        auto r = tipsy::DecoderResult::DORMANT;
+        for (auto f : b)
+            r = pd.readFloat(f);
+        REQUIRE(r == tipsy::DecoderResult::BODY_READY);
+        REQUIRE(pd.isMessageComplete());
+        REQUIRE(memcmp(outB, inB + 5, 10) == 0);
+    }
+
+    SECTION("Block Resync Matches Float At A Time")
+    {
+        // a message, then a cable patched mid message with stray begin sentinels in the noise
+        std::vector<float> stream = encode(30, 0);
+        auto cut = encode(60, 10);
+        stream.insert(stream.end(), cut.begin() + cut.size() / 3, cut.end());
+        for (int i = 0; i < 100; ++i)
+            stream.push_back(i % 17 == 3 ? tipsy::kMessageBeginSentinel : 0.01f * i);
+        stream.push_back(tipsy::kMessageBeginSentinel);
+        stream.push_back(tipsy::kMessageBeginSentinel);
+        stream.push_back(tipsy::kEndMessageSentinel);
+        for (int m = 0; m < 3; ++m)
+        {
+            auto e = encode(20 + m, m * 30);
+            stream.insert(stream.end(), e.begin(), e.end());
+        }
+
+        std::vector<tipsy::DecoderEvent> expected;
+        uint32_t discarded{0};
+        {
+            tipsy::ProtocolDecoder pd;
+            pd.provideDataBuffer(outB, sizeof(outB));
+            pd.setResyncOnError(true);
+            for (size_t i = 0; i < stream.size(); ++i)
+            {
+                if (i == 30)
+                    pd.resync();
+                auto r = pd.readFloat(stream[i]);
+                if (r == tipsy::DecoderResult::HEADER_READY ||
+                    r == tipsy::DecoderResult::BODY_READY ||
+                    r == tipsy::DecoderResult::RESYNCED || pd.isError(r))
+                    expected.push_back({r, (uint32_t)i});
+            }
+            discarded = pd.getDiscardedFloats();
+        }
+        REQUIRE(discarded > 100);
+
+        for (size_t block : {1, 2, 5, 64})
+        {
+            INFO("Block " << block);
+            tipsy::ProtocolDecoder pd;
+            pd.provideDataBuffer(outB, sizeof(outB));
+            pd.setResyncOnError(true);
+            std::vector<tipsy::DecoderEvent> got;
+            tipsy::DecoderEvent ev[16];
+            // readFloats stops after each body, so go round until the range is used up
+            auto feed = [&](size_t from, size_t count) {
+                size_t i{0};
+                while (i < count)
+                {
+                    auto c = pd.readFloats(stream.data() + from + i, count - i, ev, 16);
+                    for (size_t e = 0; e < c; ++e)
+                        got.push_back({ev[e].result, (uint32_t)(from + i + ev[e].offset)});
+                    if (c == 0 || (c < 16 && ev[c - 1].result != tipsy::DecoderResult::BODY_READY))
+                        break;
+                    i += ev[c - 1].offset + 1;
+                }
+            };
+            for (size_t start = 0; start < stream.size(); start += block)
+            {
+                auto n = std::min(block, stream.size() - start);
+                if (start <= 30 && 30 < start + n)
+                {
+                    // resync lands at float 30, so feed up to it first
+                    feed(start, 30 - start);
+                    pd.resync();
+                    feed(30, start + n - 30);
+                    continue;
+                }
+                feed(start, n);
+            }
+            REQUIRE(pd.getDiscardedFloats() == discarded);
+            REQUIRE(got.size() == expected.size());
+            for (size_t k = 0; k < got.size(); ++k)
+            {
+                REQUIRE(got[k].result == expected[k].result);
+                REQUIRE(got[k].offset == expected[k].offset);
+            }
+        }
+    }
+}
@@ -0,0 +1,348 @@
+/*
+ * Test the queued encoder
+ */
+
+#include "catch2.hpp"
+#include "tipsy/tipsy.h"
+
+#include <atomic>
+#include <cstring>
+#include <string>
+#include <thread>
+#include <vector>
+
+TEST_CASE("Queued Encoder Enqueue Checks")
+{
+    tipsy::QueuedProtocolEncoder<4> qe;
+    unsigned char d[4]{1, 2, 3, 4};
+
+    REQUIRE(qe.isDormant());
+    REQUIRE(qe.enqueueMessage(nullptr, 4, d) == tipsy::EncoderResult::ERROR_MISSING_MIME_TYPE);
+    REQUIRE(qe.enqueueMessage("a", 4, nullptr) == tipsy::EncoderResult::ERROR_MISSING_DATA);
+    REQUIRE(qe.enqueueMessage("a", tipsy::kMaxMessageLength + 1, d) ==
+            tipsy::EncoderResult::ERROR_MESSAGE_TOO_LARGE);
+    REQUIRE(qe.queuedMessages() == 0);
+
+    for (int i = 0; i < 4; ++i)
+        REQUIRE(qe.enqueueMessage("a", 4, d) == tipsy::EncoderResult::MESSAGE_QUEUED);
+    REQUIRE(qe.queuedMessages() == 4);
+    REQUIRE(qe.enqueueMessage("a", 4, d) == tipsy::EncoderResult::ERROR_QUEUE_FULL);
+    REQUIRE(!qe.isDormant());
+
+    // Starting a message frees its slot
+    float f;
+    REQUIRE(qe.getNextMessageFloat(f) == tipsy::EncoderResult::ENCODING_MESSAGE);
+    REQUIRE(qe.queuedMessages() == 3);
+    REQUIRE(qe.enqueueMessage("a", 4, d) == tipsy::EncoderResult::MESSAGE_QUEUED);
+}
+
+TEST_CASE("Queued Encoder Back To Back Messages")
+{
+    std::vector<std::string> msgs{"first message", "", "a somewhat longer third message",
+                                  "4"};
+    const char *mimeType{"text/plain"};
+
+    tipsy::QueuedProtocolEncoder<> qe;
+    for (auto &m : msgs)
+        REQUIRE(qe.enqueueMessage(mimeType, (uint32_t)m.size(),
+                                  (const unsigned char *)m.data()) ==
+                tipsy::EncoderResult::MESSAGE_QUEUED);
+
+    unsigned char outB[256];
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(outB, sizeof(outB));
+
+    size_t got{0};
+    bool lastComplete{false};
+    for (int i = 0; i < 10000 && !qe.isDormant(); ++i)
+    {
+        float f;
+        auto er = qe.getNextMessageFloat(f);
+        REQUIRE(!qe.isError(er));
+        REQUIRE(er != tipsy::EncoderResult::DORMANT);
+
+        // The sample after a completed message opens the next one
+        if (lastComplete)
+            REQUIRE(f == tipsy::kMessageBeginSentinel);
+        lastComplete = (er == tipsy::EncoderResult::MESSAGE_COMPLETE);
+
+        auto dr = pd.readFloat(f);
+        REQUIRE(!tipsy::ProtocolDecoder::isError(dr));
+        if (dr == tipsy::DecoderResult::BODY_READY)
+        {
+            REQUIRE(got < msgs.size());
+            REQUIRE(pd.getDataSize() == msgs[got].size());
+            REQUIRE(std::string((const char *)outB, pd.getDataSize()) == msgs[got]);
+            got++;
+        }
+    }
+    REQUIRE(got == msgs.size());
+    REQUIRE(lastComplete);
+
+    float f;
+    REQUIRE(qe.getNextMessageFloat(f) == tipsy::EncoderResult::DORMANT);
+}
+
+TEST_CASE("Queued Encoder Block Matches Per Float")
+{
+    std::vector<unsigned char> a(1000), b(37);
+    for (size_t i = 0; i < a.size(); ++i)
+        a[i] = (unsigned char)(i * 7 + 1);
+    for (size_t i = 0; i < b.size(); ++i)
+        b[i] = (unsigned char)(i * 13 + 5);
+
+    tipsy::QueuedProtocolEncoder<> one, blk;
+    for (auto *q : {&one, &blk})
+    {
+        REQUIRE(q->enqueueMessage("application/a", (uint32_t)a.size(), a.data()) ==
+                tipsy::EncoderResult::MESSAGE_QUEUED);
+        REQUIRE(q->enqueueMessage("application/b", (uint32_t)b.size(), b.data()) ==
+                tipsy::EncoderResult::MESSAGE_QUEUED);
+    }
+
+    std::vector<float> ref;
+    float f;
+    while (!one.isDormant())
+    {
+        REQUIRE(!one.isError(one.getNextMessageFloat(f)));
+        ref.push_back(f);
+    }
+
+    std::vector<float> got(ref.size() + 50, -1.f);
+    size_t w{0};
+    while (w < got.size())
+    {
+        auto c = blk.getNextMessageFloats(got.data() + w, std::min<size_t>(61, got.size() - w));
+        if (c == 0)
+            break;
+        w += c;
+    }
+    REQUIRE(w == ref.size());
+    REQUIRE(blk.isDormant());
+    REQUIRE(memcmp(ref.data(), got.data(), ref.size() * sizeof(float)) == 0);
+}
+
+TEST_CASE("Queued Encoder Terminate Starts Next")
+{
+    unsigned char d[300];
+    for (int i = 0; i < 300; ++i)
+        d[i] = (unsigned char)i;
+
+    tipsy::QueuedProtocolEncoder<> qe;
+    REQUIRE(qe.enqueueMessage("a", 300, d) == tipsy::EncoderResult::MESSAGE_QUEUED);
+    REQUIRE(qe.enqueueMessage("b", 3, d) == tipsy::EncoderResult::MESSAGE_QUEUED);
+
+    float f;
+    for (int i = 0; i < 20; ++i)
+        REQUIRE(qe.getNextMessageFloat(f) == tipsy::EncoderResult::ENCODING_MESSAGE);
+    REQUIRE(qe.terminateCurrentMessage() == tipsy::EncoderResult::MESSAGE_TERMINATED);
+    REQUIRE(qe.getNextMessageFloat(f) == tipsy::EncoderResult::ENCODING_MESSAGE);
+    REQUIRE(f == tipsy::kMessageBeginSentinel);
+    REQUIRE(qe.queuedMessages() == 0);
+}
+
+TEST_CASE("Queued Encoder Across Threads")
+{
+    static constexpr int nMessages{2000};
+
+    // Every message gets its own storage since it has to outlive its time in the queue
+    std::vector<std::vector<unsigned char>> payloads(nMessages);
+    for (int m = 0; m < nMessages; ++m)
+    {
+        payloads[m].resize(1 + (m * 37) % 211);
+        for (size_t i = 0; i < payloads[m].size(); ++i)
+            payloads[m][i] = (unsigned char)(m + i * 3);
+    }
+
+    tipsy::QueuedProtocolEncoder<8> qe;
+
+    std::thread producer([&]() {
+        for (int m = 0; m < nMessages; ++m)
+        {
+            while (true)
+            {
+                auto r = qe.enqueueMessage("application/octet-stream",
+                                           (uint32_t)payloads[m].size(), payloads[m].data());
+                if (r == tipsy::EncoderResult::MESSAGE_QUEUED)
+                    break;
+                if (r != tipsy::EncoderResult::ERROR_QUEUE_FULL)
+                    return;
+                std::this_thread::yield();
+            }
+        }
+    });
+
+    unsigned char outB[256];
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(outB, sizeof(outB));
+
+    int got{0};
+    bool ok{true};
+    float block[64];
+    // Bounded so a lost message fails rather than hangs
+    for (long iter = 0; iter < 100000000L && got < nMessages && ok; ++iter)
+    {
+        auto n = qe.getNextMessageFloats(block, 64);
+        if (n == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < n && ok; ++i)
+        {
+            auto dr = pd.readFloat(block[i]);
+            if (tipsy::ProtocolDecoder::isError(dr))
+                ok = false;
+            if (dr == tipsy::DecoderResult::BODY_READY)
+            {
+                auto &p = payloads[got];
+                ok = ok && pd.getDataSize() == p.size() &&
+                     memcmp(outB, p.data(), p.size()) == 0;
+                got++;
+            }
+        }
+    }
+    producer.join();
+
+    REQUIRE(ok);
+    REQUIRE(got == nMessages);
+    REQUIRE(qe.isDormant());
+}
+
+namespace
+{
+struct ReleaseLog
+{
+    std::vector<const unsigned char *> data;
+    std::vector<tipsy::EncoderResult> how;
+
+    static void release(void *ud, const char *, const unsigned char *d, tipsy::EncoderResult h)
+    {
+        auto *that = static_cast<ReleaseLog *>(ud);
+        that->data.push_back(d);
+        that->how.push_back(h);
+    }
+};
+} // namespace
+
+TEST_CASE("Queued Encoder Release Callbacks")
+{
+    unsigned char a[10]{}, b[100]{}, c[5]{};
+    ReleaseLog log;
+
+    tipsy::QueuedProtocolEncoder<4> qe;
+    REQUIRE(qe.enqueueMessage("a", sizeof(a), a, ReleaseLog::release, &log) ==
+            tipsy::EncoderResult::MESSAGE_QUEUED);
+    REQUIRE(qe.enqueueMessage("b", sizeof(b), b, ReleaseLog::release, &log) ==
+            tipsy::EncoderResult::MESSAGE_QUEUED);
+    REQUIRE(qe.enqueueMessage("c", sizeof(c), c) == tipsy::EncoderResult::MESSAGE_QUEUED);
+
+    // Nothing is released until the encoder is done with it and the producer asks
+    REQUIRE(qe.processReleases() == 0);
+
+    float f;
+    while (qe.getNextMessageFloat(f) != tipsy::EncoderResult::MESSAGE_COMPLETE)
+        ;
+    for (int i = 0; i < 20; ++i)
+        REQUIRE(qe.getNextMessageFloat(f) == tipsy::EncoderResult::ENCODING_MESSAGE);
+    REQUIRE(log.data.empty());
+
+    REQUIRE(qe.processReleases() == 1);
+    REQUIRE(log.data.size() == 1);
+    REQUIRE(log.data[0] == a);
+    REQUIRE(log.how[0] == tipsy::EncoderResult::MESSAGE_COMPLETE);
+
+    REQUIRE(qe.terminateCurrentMessage() == tipsy::EncoderResult::MESSAGE_TERMINATED);
+    while (!qe.isDormant())
+        REQUIRE(!qe.isError(qe.getNextMessageFloat(f)));
+
+    // c has no callback but still passes through the return queue
+    REQUIRE(qe.processReleases() == 2);
+    REQUIRE(log.data.size() == 2);
+    REQUIRE(log.data[1] == b);
+    REQUIRE(log.how[1] == tipsy::EncoderResult::MESSAGE_TERMINATED);
+    REQUIRE(qe.processReleases() == 0);
+}
+
+TEST_CASE("Queued Encoder Recycles A Buffer Pool Across Threads")
+{
+    static constexpr int nMessages{1000}, nBuffers{3}, bufferSize{97};
+
+    // The producer owns the pool; releases run on the producer thread so it needs no lock
+    unsigned char pool[nBuffers][bufferSize];
+    std::vector<unsigned char *> freeList;
+    for (auto &p : pool)
+        freeList.push_back(p);
+
+    auto releaseToPool = [](void *ud, const char *, const unsigned char *d,
+                            tipsy::EncoderResult) {
+        static_cast<std::vector<unsigned char *> *>(ud)->push_back((unsigned char *)d);
+    };
+
+    tipsy::QueuedProtocolEncoder<8> qe;
+    std::atomic<bool> consumerDone{false};
+
+    std::thread producer([&]() {
+        for (int m = 0; m < nMessages; ++m)
+        {
+            while (freeList.empty())
+            {
+                if (consumerDone)
+                    return;
+                qe.processReleases();
+                std::this_thread::yield();
+            }
+            auto *buf = freeList.back();
+            freeList.pop_back();
+            for (int i = 0; i < bufferSize; ++i)
+                buf[i] = (unsigned char)(m * 5 + i);
+
+            auto r = qe.enqueueMessage("application/octet-stream", bufferSize, buf,
+                                       releaseToPool, &freeList);
+            if (r != tipsy::EncoderResult::MESSAGE_QUEUED)
+                return;
+        }
+        while (freeList.size() != nBuffers && !consumerDone)
+        {
+            qe.processReleases();
+            std::this_thread::yield();
+        }
+    });
+
+    unsigned char outB[bufferSize + 1];
+    tipsy::ProtocolDecoder pd;
+    pd.provideDataBuffer(outB, sizeof(outB));
+
+    int got{0};
+    bool ok{true};
+    float block[32];
+    for (long iter = 0; iter < 100000000L && got < nMessages && ok; ++iter)
+    {
+        auto n = qe.getNextMessageFloats(block, 32);
+        if (n == 0)
+        {
+            std::this_thread::yield();
+            continue;
+        }
+        for (size_t i = 0; i < n && ok; ++i)
+        {
+            auto dr = pd.readFloat(block[i]);
+            if (tipsy::ProtocolDecoder::isError(dr))
+                ok = false;
+            if (dr == tipsy::DecoderResult::BODY_READY)
+            {
+                for (int j = 0; j < bufferSize; ++j)
+                    ok = ok && outB[j] == (unsigned char)(got * 5 + j);
+                got++;
+            }
+        }
+    }
+    consumerDone = true;
+    producer.join();
+    // the producer may have stopped waiting before the last release came back
+    qe.processReleases();
+
+    REQUIRE(ok);
+    REQUIRE(got == nMessages);
+    REQUIRE(freeList.size() == nBuffers);
+}